@@ -0,0 +1,150 @@
+#ifndef AFFINE_INVARIANT_FEATURES_BATCH_MATCHER
+#define AFFINE_INVARIANT_FEATURES_BATCH_MATCHER
+
+#include <vector>
+
+#include <affine_invariant_features/parallel_tasks.hpp>
+#include <affine_invariant_features/result_matcher.hpp>
+#include <affine_invariant_features/results.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// Matching of bursts of sources against many targets.
+// Sources are grouped into batches and each target searches descriptors of a batch at once.
+// The size of batches is chosen so that a batch is expected to be processed
+// within the max latency, on the basis of the measured cost of past batches.
+//
+
+class BatchMatcher {
+public:
+  // all sources given to match() are processed as one batch if max_latency <= 0
+  BatchMatcher(const std::vector< cv::Ptr< const ResultMatcher > > &matchers,
+               const std::vector< double > &min_match_ratios = std::vector< double >(),
+               const double max_latency = 0.)
+      : matchers_(matchers), min_match_ratios_(min_match_ratios), max_latency_(max_latency),
+        seconds_per_row_(0.) {
+    CV_Assert(min_match_ratios_.empty() || matchers_.size() == min_match_ratios_.size());
+  }
+
+  virtual ~BatchMatcher() {}
+
+  // max seconds to process a batch
+  double getMaxLatency() const { return max_latency_; }
+
+  void setMaxLatency(const double max_latency) { max_latency_ = max_latency; }
+
+  // moving average of seconds to process a batch per source descriptor
+  double getSecondsPerRow() const { return seconds_per_row_; }
+
+  // outputs are indexed by [source][matcher]
+  void match(const std::vector< cv::Ptr< const Results > > &sources,
+             std::vector< std::vector< cv::Matx33f > > &transforms_array,
+             std::vector< std::vector< std::vector< cv::DMatch > > > &matches_arrays,
+             const double nstripes = -1.) {
+    // weight of the latest batch in the moving average
+    static const double alpha(0.2);
+
+    // initiate output
+    const int nsources(sources.size());
+    for (int i = 0; i < nsources; ++i) {
+      CV_Assert(sources[i]);
+    }
+    transforms_array.assign(nsources,
+                            std::vector< cv::Matx33f >(matchers_.size(), cv::Matx33f::eye()));
+    matches_arrays.assign(nsources, std::vector< std::vector< cv::DMatch > >(matchers_.size()));
+
+    for (int begin = 0; begin < nsources;) {
+      const int end(batchEnd(sources, begin));
+
+      const int64 start(cv::getTickCount());
+      matchBatch(sources, begin, end, transforms_array, matches_arrays, nstripes);
+      const double seconds((cv::getTickCount() - start) / cv::getTickFrequency());
+
+      // update the cost estimate
+      int rows(0);
+      for (int i = begin; i < end; ++i) {
+        rows += sources[i]->descriptors.rows;
+      }
+      if (rows > 0) {
+        seconds_per_row_ = seconds_per_row_ > 0.
+                               ? (1. - alpha) * seconds_per_row_ + alpha * seconds / rows
+                               : seconds / rows;
+      }
+
+      begin = end;
+    }
+  }
+
+protected:
+  // the end of the batch beginning at the given source
+  int batchEnd(const std::vector< cv::Ptr< const Results > > &sources, const int begin) const {
+    const int nsources(sources.size());
+    if (max_latency_ <= 0.) {
+      return nsources;
+    }
+    // the first batch has only one source to measure the cost
+    if (seconds_per_row_ <= 0.) {
+      return begin + 1;
+    }
+
+    // a batch has one source at least even if it exceeds the latency
+    const double max_rows(max_latency_ / seconds_per_row_);
+    double rows(sources[begin]->descriptors.rows);
+    int end(begin + 1);
+    while (end < nsources && rows + sources[end]->descriptors.rows <= max_rows) {
+      rows += sources[end]->descriptors.rows;
+      ++end;
+    }
+    return end;
+  }
+
+  void matchBatch(const std::vector< cv::Ptr< const Results > > &sources, const int begin,
+                  const int end, std::vector< std::vector< cv::Matx33f > > &transforms_array,
+                  std::vector< std::vector< std::vector< cv::DMatch > > > &matches_arrays,
+                  const double nstripes) const {
+    const std::vector< cv::Ptr< const Results > > batch(sources.begin() + begin,
+                                                        sources.begin() + end);
+
+    // populate tasks
+    const int ntasks(matchers_.size());
+    std::vector< std::vector< cv::Matx33f > > batch_transforms(ntasks);
+    std::vector< std::vector< std::vector< cv::DMatch > > > batch_matches(ntasks);
+    ParallelTasks tasks(ntasks);
+    for (int i = 0; i < ntasks; ++i) {
+      if (matchers_[i]) {
+        tasks[i] = boost::bind(&ResultMatcher::matchBatch, matchers_[i].get(), boost::cref(batch),
+                               boost::ref(batch_transforms[i]), boost::ref(batch_matches[i]),
+                               min_match_ratios_.empty() ? 0. : min_match_ratios_[i],
+                               static_cast< std::vector< VerificationReport > * >(NULL));
+      }
+    }
+
+    // do paralell matching
+    cv::parallel_for_(cv::Range(0, ntasks), tasks, nstripes);
+
+    // rearrange results by sources
+    for (int i = 0; i < ntasks; ++i) {
+      for (std::size_t j = 0; j < batch_transforms[i].size(); ++j) {
+        transforms_array[begin + j][i] = batch_transforms[i][j];
+        matches_arrays[begin + j][i].swap(batch_matches[i][j]);
+      }
+    }
+  }
+
+protected:
+  const std::vector< cv::Ptr< const ResultMatcher > > matchers_;
+  const std::vector< double > min_match_ratios_;
+  double max_latency_;
+  double seconds_per_row_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
@@ -58,6 +58,18 @@ read(const cv::FileNode &fn, T &val, const T &default_val) {
   }
 }
 
+// flag to open cv::FileStorage which writes matrices as raw bytes in base64 instead of text
+// (e.g. cv::FileStorage::WRITE | getBase64StorageFlag()). matrices are still "opencv-matrix"
+// nodes which readers of OpenCV 3.2 or later decode transparently.
+// 0 if OpenCV is older and does not support base64.
+static inline int getBase64StorageFlag() {
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 2)
+  return cv::FileStorage::BASE64;
+#else
+  return 0;
+#endif
+}
+
 // called by operator<<(cv::FileStorage, T)
 static inline void write(cv::FileStorage &fs, const std::string &, const CvSerializable &val) {
   val.write(fs);
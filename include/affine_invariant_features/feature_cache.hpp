@@ -0,0 +1,100 @@
+#ifndef AFFINE_INVARIANT_FEATURES_FEATURE_CACHE
+#define AFFINE_INVARIANT_FEATURES_FEATURE_CACHE
+
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/results_file.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+
+#include <opencv2/core.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A directory of results in the binary format, addressed by the md5 of the target image,
+// the hash of the parameters and the hash of the target contour which masks the extraction.
+// Results of unchanged images, parameters and contours are found without extraction.
+//
+
+class FeatureCache {
+public:
+  virtual ~FeatureCache() {}
+
+  // the directory is created if not exists.
+  // return an empty pointer if the directory cannot be created (e.g. not writable).
+  static cv::Ptr< FeatureCache > open(const std::string &dir) {
+    boost::system::error_code error;
+    boost::filesystem::create_directories(dir, error);
+    if (error || !boost::filesystem::is_directory(dir, error)) {
+      return cv::Ptr< FeatureCache >();
+    }
+    return new FeatureCache(dir);
+  }
+
+  const std::string &getDirectory() const { return dir_; }
+
+  std::string getPath(const std::string &md5, const boost::uint64_t params_hash,
+                      const boost::uint64_t contour_hash) const {
+    std::ostringstream oss;
+    oss << md5 << std::hex << std::setfill('0') << "-" << std::setw(16) << params_hash << "-"
+        << std::setw(16) << contour_hash << ".aifr";
+    return (boost::filesystem::path(dir_) / oss.str()).string();
+  }
+
+  // return an empty pointer if no results are cached for the key
+  cv::Ptr< MappedResults > find(const std::string &md5, const boost::uint64_t params_hash,
+                                const boost::uint64_t contour_hash) const {
+    if (md5.empty() || params_hash == 0) {
+      return cv::Ptr< MappedResults >();
+    }
+    // a file with other hashes may be left by an older version of parameters
+    const cv::Ptr< MappedResults > results(
+        mapResultsFile(getPath(md5, params_hash, contour_hash), params_hash));
+    if (!results || results->contourHash != contour_hash) {
+      return cv::Ptr< MappedResults >();
+    }
+    return results;
+  }
+
+  // return false if the key is invalid or the results cannot be cached
+  // (e.g. the directory is not writable). the cache is unchanged in that case.
+  bool insert(const std::string &md5, const boost::uint64_t params_hash,
+              const boost::uint64_t contour_hash, const Results &results) const {
+    namespace bf = boost::filesystem;
+
+    if (md5.empty() || params_hash == 0) {
+      return false;
+    }
+    // write a temporary file and rename it
+    // so that other processes never find an incomplete file
+    const bf::path path(getPath(md5, params_hash, contour_hash));
+    const bf::path tmp_path(path.string() + bf::unique_path(".%%%%-%%%%").string());
+    boost::system::error_code error;
+    try {
+      writeResultsFile(tmp_path.string(), results, params_hash, contour_hash);
+      bf::rename(tmp_path, path, error);
+    } catch (const cv::Exception & /* error */) {
+      error = boost::system::errc::make_error_code(boost::system::errc::io_error);
+    }
+    if (error) {
+      bf::remove(tmp_path, error);
+      return false;
+    }
+    return true;
+  }
+
+protected:
+  FeatureCache(const std::string &dir) : dir_(dir) {}
+
+protected:
+  const std::string dir_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
@@ -6,6 +6,9 @@
 
 #include <affine_invariant_features/affine_invariant_feature.hpp>
 #include <affine_invariant_features/cv_serializable.hpp>
+#include <affine_invariant_features/hash.hpp>
+
+#include <boost/cstdint.hpp>
 
 #include <opencv2/core.hpp>
 #include <opencv2/features2d.hpp>
@@ -24,6 +27,23 @@ public:
   virtual ~FeatureParameters() {}
 
   virtual cv::Ptr< cv::Feature2D > createFeature() const = 0;
+
+  // canonical hash of the type and values of parameters, which identifies results generated by
+  // the same parameters. stable across processes and platforms with the same byte order.
+  // never returns 0, which means unknown parameters in result files.
+  boost::uint64_t hash() const {
+    const boost::uint64_t value(hashValues(fnv1a64Value(getDefaultName())));
+    return value != 0 ? value : 1;
+  }
+
+protected:
+  // continue the hash by values of parameters. the default implementation hashes
+  // the serialized text, which is slower and should be overloaded.
+  virtual boost::uint64_t hashValues(const boost::uint64_t seed) const {
+    cv::FileStorage fs(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+    write(fs);
+    return fnv1a64Value(std::string(fs.releaseAndGetString()), seed);
+  }
 };
 
 //
@@ -80,6 +100,15 @@ public:
   }
 
   virtual std::string getDefaultName() const { return "AIFParameters"; }
+
+protected:
+  virtual boost::uint64_t hashValues(const boost::uint64_t seed) const {
+    boost::uint64_t hash(fnv1a64Value< boost::uint64_t >(size(), seed));
+    for (std::vector< cv::Ptr< FeatureParameters > >::const_iterator p = begin(); p != end(); ++p) {
+      hash = fnv1a64Value< boost::uint64_t >(*p ? (*p)->hash() : 0, hash);
+    }
+    return hash;
+  }
 };
 
 //
@@ -126,6 +155,18 @@ public:
   virtual std::string getDefaultName() const { return "AKAZEParameters"; }
 
 protected:
+  virtual boost::uint64_t hashValues(const boost::uint64_t seed) const {
+    boost::uint64_t hash(seed);
+    hash = fnv1a64Value< boost::int32_t >(descriptorType, hash);
+    hash = fnv1a64Value< boost::int32_t >(descriptorSize, hash);
+    hash = fnv1a64Value< boost::int32_t >(descriptorChannels, hash);
+    hash = fnv1a64Value< float >(threshold, hash);
+    hash = fnv1a64Value< boost::int32_t >(nOctaves, hash);
+    hash = fnv1a64Value< boost::int32_t >(nOctaveLayers, hash);
+    hash = fnv1a64Value< boost::int32_t >(diffusivity, hash);
+    return hash;
+  }
+
   static const cv::AKAZE &defaultAKAZE() {
     static cv::Ptr< const cv::AKAZE > default_akaze(cv::AKAZE::create());
     CV_Assert(default_akaze);
@@ -171,6 +212,15 @@ public:
 
   virtual std::string getDefaultName() const { return "BRISKParameters"; }
 
+protected:
+  virtual boost::uint64_t hashValues(const boost::uint64_t seed) const {
+    boost::uint64_t hash(seed);
+    hash = fnv1a64Value< boost::int32_t >(threshold, hash);
+    hash = fnv1a64Value< boost::int32_t >(nOctaves, hash);
+    hash = fnv1a64Value< float >(patternScale, hash);
+    return hash;
+  }
+
 public:
   int threshold;
   int nOctaves;
@@ -213,6 +263,17 @@ public:
 
   virtual std::string getDefaultName() const { return "SIFTParameters"; }
 
+protected:
+  virtual boost::uint64_t hashValues(const boost::uint64_t seed) const {
+    boost::uint64_t hash(seed);
+    hash = fnv1a64Value< boost::int32_t >(nfeatures, hash);
+    hash = fnv1a64Value< boost::int32_t >(nOctaveLayers, hash);
+    hash = fnv1a64Value< double >(contrastThreshold, hash);
+    hash = fnv1a64Value< double >(edgeThreshold, hash);
+    hash = fnv1a64Value< double >(sigma, hash);
+    return hash;
+  }
+
 public:
   int nfeatures;
   int nOctaveLayers;
@@ -258,6 +319,16 @@ public:
   virtual std::string getDefaultName() const { return "SURFParameters"; }
 
 protected:
+  virtual boost::uint64_t hashValues(const boost::uint64_t seed) const {
+    boost::uint64_t hash(seed);
+    hash = fnv1a64Value< double >(hessianThreshold, hash);
+    hash = fnv1a64Value< boost::int32_t >(nOctaves, hash);
+    hash = fnv1a64Value< boost::int32_t >(nOctaveLayers, hash);
+    hash = fnv1a64Value< boost::uint8_t >(extended, hash);
+    hash = fnv1a64Value< boost::uint8_t >(upright, hash);
+    return hash;
+  }
+
   static const cv::xfeatures2d::SURF &defaultSURF() {
     static cv::Ptr< const cv::xfeatures2d::SURF > default_surf(cv::xfeatures2d::SURF::create());
     CV_Assert(default_surf);
@@ -0,0 +1,205 @@
+#ifndef AFFINE_INVARIANT_FEATURES_GEMM_L2_MATCHER
+#define AFFINE_INVARIANT_FEATURES_GEMM_L2_MATCHER
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// An exact brute-force matcher for NORM_L2 descriptors by matrix multiplication.
+// Squared distances between blocks of query and train descriptors are computed
+// as |q|^2 + |t|^2 - 2 q.t where q.t of a whole block pair is a single cv::gemm call,
+// and the nearest neighbors are selected from each block of products right after it is computed
+// so that the full distance matrix is never stored.
+//
+
+class GemmL2Matcher : public cv::DescriptorMatcher {
+protected:
+  // a pair of a squared distance and a descriptor id
+  typedef std::pair< float, int > Candidate;
+
+public:
+  // the numbers of query and train rows in a block, which bound the size of a product matrix
+  GemmL2Matcher(const int queryBlock = 256, const int trainBlock = 4096)
+      : query_block_(queryBlock), train_block_(trainBlock), dims_(0), offsets_(1, 0) {
+    CV_Assert(query_block_ > 0 && train_block_ > 0);
+  }
+
+  virtual ~GemmL2Matcher() {}
+
+  static cv::Ptr< GemmL2Matcher > create(const int queryBlock = 256, const int trainBlock = 4096) {
+    return new GemmL2Matcher(queryBlock, trainBlock);
+  }
+
+  //
+  // overloaded functions from cv::DescriptorMatcher or its base class
+  //
+
+  virtual void clear() {
+    cv::DescriptorMatcher::clear();
+    dims_ = 0;
+    norms_.clear();
+    offsets_.assign(1, 0);
+  }
+
+  virtual bool isMaskSupported() const { return false; }
+
+  virtual void train() {
+    // compute squared norms of descriptors added after the last training
+    for (std::size_t i = offsets_.size() - 1; i < trainDescCollection.size(); ++i) {
+      const cv::Mat &descriptors(trainDescCollection[i]);
+      // an image without descriptors takes no ids
+      if (descriptors.empty()) {
+        norms_.push_back(cv::Mat());
+        offsets_.push_back(offsets_.back());
+        continue;
+      }
+      CV_Assert(descriptors.type() == CV_32FC1);
+      CV_Assert(offsets_.back() == 0 || descriptors.cols == dims_);
+      dims_ = descriptors.cols;
+      norms_.push_back(squaredNorms(descriptors));
+      offsets_.push_back(offsets_.back() + descriptors.rows);
+    }
+  }
+
+  virtual cv::Ptr< cv::DescriptorMatcher > clone(const bool emptyTrainData = false) const {
+    const cv::Ptr< GemmL2Matcher > matcher(new GemmL2Matcher(query_block_, train_block_));
+    if (!emptyTrainData) {
+      matcher->trainDescCollection = trainDescCollection;
+      matcher->dims_ = dims_;
+      matcher->norms_ = norms_;
+      matcher->offsets_ = offsets_;
+    }
+    return matcher;
+  }
+
+  virtual cv::String getDefaultName() const { return "GemmL2Matcher"; }
+
+protected:
+  virtual void knnMatchImpl(cv::InputArray queryDescriptors,
+                            std::vector< std::vector< cv::DMatch > > &matches, int k,
+                            cv::InputArrayOfArrays /* masks */, bool /* compactResult */) {
+    std::vector< std::vector< Candidate > > candidates;
+    search(queryDescriptors.getMat(), k, FLT_MAX, candidates);
+
+    matches.clear();
+    matches.resize(candidates.size());
+    for (std::size_t i = 0; i < candidates.size(); ++i) {
+      for (std::size_t c = 0; c < candidates[i].size(); ++c) {
+        matches[i].push_back(toDMatch(i, candidates[i][c]));
+      }
+    }
+  }
+
+  virtual void radiusMatchImpl(cv::InputArray queryDescriptors,
+                               std::vector< std::vector< cv::DMatch > > &matches,
+                               float maxDistance, cv::InputArrayOfArrays /* masks */,
+                               bool /* compactResult */) {
+    std::vector< std::vector< Candidate > > candidates;
+    search(queryDescriptors.getMat(), 0, maxDistance * maxDistance, candidates);
+
+    matches.clear();
+    matches.resize(candidates.size());
+    for (std::size_t i = 0; i < candidates.size(); ++i) {
+      std::sort(candidates[i].begin(), candidates[i].end());
+      for (std::size_t c = 0; c < candidates[i].size(); ++c) {
+        matches[i].push_back(toDMatch(i, candidates[i][c]));
+      }
+    }
+  }
+
+  // find the k nearest descriptors within max_distance2 for each query.
+  // k == 0 means all descriptors within max_distance2.
+  void search(const cv::Mat &query, const int k, const float max_distance2,
+              std::vector< std::vector< Candidate > > &candidates) const {
+    CV_Assert(query.type() == CV_32FC1);
+    CV_Assert(offsets_.back() == 0 || query.cols == dims_);
+
+    candidates.clear();
+    candidates.resize(query.rows);
+    const cv::Mat query_norms(squaredNorms(query));
+    cv::Mat products;
+    for (int q0 = 0; q0 < query.rows; q0 += query_block_) {
+      const cv::Range query_rows(q0, std::min(q0 + query_block_, query.rows));
+      for (std::size_t img = 0; img < norms_.size(); ++img) {
+        const cv::Mat &train(trainDescCollection[img]);
+        for (int t0 = 0; t0 < train.rows; t0 += train_block_) {
+          const cv::Range train_rows(t0, std::min(t0 + train_block_, train.rows));
+
+          // -2 q.t of all pairs in the blocks
+          cv::gemm(query.rowRange(query_rows), train.rowRange(train_rows), -2., cv::noArray(), 0.,
+                   products, cv::GEMM_2_T);
+
+          // select neighbors from the products
+          const float *const train_norms(norms_[img].ptr< float >() + t0);
+          for (int r = 0; r < products.rows; ++r) {
+            const int q(q0 + r);
+            const float query_norm(query_norms.at< float >(q));
+            const float *const product(products.ptr< float >(r));
+            std::vector< Candidate > &best(candidates[q]);
+            for (int c = 0; c < products.cols; ++c) {
+              const float distance2(std::max(query_norm + train_norms[c] + product[c], 0.f));
+              if (distance2 > max_distance2) {
+                continue;
+              }
+              if (k == 0) {
+                best.push_back(Candidate(distance2, offsets_[img] + t0 + c));
+              } else if (static_cast< int >(best.size()) < k || distance2 < best.back().first) {
+                insert(best, Candidate(distance2, offsets_[img] + t0 + c), k);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // insert the candidate to the sorted list of at most k candidates
+  static void insert(std::vector< Candidate > &best, const Candidate &candidate, const int k) {
+    if (static_cast< int >(best.size()) < k) {
+      best.push_back(candidate);
+    } else {
+      best.back() = candidate;
+    }
+    for (std::size_t i = best.size() - 1; i > 0 && best[i] < best[i - 1]; --i) {
+      std::swap(best[i], best[i - 1]);
+    }
+  }
+
+  static cv::Mat squaredNorms(const cv::Mat &descriptors) {
+    cv::Mat norms(descriptors.rows, 1, CV_32FC1);
+    for (int r = 0; r < descriptors.rows; ++r) {
+      const cv::Mat row(descriptors.row(r));
+      norms.at< float >(r) = static_cast< float >(row.dot(row));
+    }
+    return norms;
+  }
+
+  cv::DMatch toDMatch(const int query_idx, const Candidate &candidate) const {
+    const int img(std::upper_bound(offsets_.begin(), offsets_.end(), candidate.second) -
+                  offsets_.begin() - 1);
+    return cv::DMatch(query_idx, candidate.second - offsets_[img], img,
+                      std::sqrt(candidate.first));
+  }
+
+protected:
+  int query_block_;
+  int train_block_;
+
+  int dims_;
+  // squared norms of descriptors of each image
+  std::vector< cv::Mat > norms_;
+  // the first id of each image and the total number of ids
+  std::vector< int > offsets_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
@@ -0,0 +1,555 @@
+#ifndef AFFINE_INVARIANT_FEATURES_GEOMETRIC_VERIFIER
+#define AFFINE_INVARIANT_FEATURES_GEOMETRIC_VERIFIER
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <affine_invariant_features/cv_serializable.hpp>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace affine_invariant_features {
+
+//
+// Parameters of geometric verification of matches
+//
+
+struct VerificationParameters : public CvSerializable {
+public:
+  VerificationParameters()
+      : duplicateTolerance(1.), houghAngleBin(0.), houghScaleBin(1.), houghLocationBin(0.25),
+        houghMinVoteRatio(0.5), sampleSize(4), reprojThreshold(5.), confidence(0.995),
+        maxIterations(2000), maxSeconds(0.) {}
+
+  virtual ~VerificationParameters() {}
+
+  // a missing value keeps the current one (the default if just constructed)
+  virtual void read(const cv::FileNode &fn) {
+    cv::read(fn["duplicateTolerance"], duplicateTolerance, duplicateTolerance);
+    cv::read(fn["houghAngleBin"], houghAngleBin, houghAngleBin);
+    cv::read(fn["houghScaleBin"], houghScaleBin, houghScaleBin);
+    cv::read(fn["houghLocationBin"], houghLocationBin, houghLocationBin);
+    cv::read(fn["houghMinVoteRatio"], houghMinVoteRatio, houghMinVoteRatio);
+    cv::read(fn["sampleSize"], sampleSize, sampleSize);
+    cv::read(fn["reprojThreshold"], reprojThreshold, reprojThreshold);
+    cv::read(fn["confidence"], confidence, confidence);
+    cv::read(fn["maxIterations"], maxIterations, maxIterations);
+    cv::read(fn["maxSeconds"], maxSeconds, maxSeconds);
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "duplicateTolerance" << duplicateTolerance;
+    fs << "houghAngleBin" << houghAngleBin;
+    fs << "houghScaleBin" << houghScaleBin;
+    fs << "houghLocationBin" << houghLocationBin;
+    fs << "houghMinVoteRatio" << houghMinVoteRatio;
+    fs << "sampleSize" << sampleSize;
+    fs << "reprojThreshold" << reprojThreshold;
+    fs << "confidence" << confidence;
+    fs << "maxIterations" << maxIterations;
+    fs << "maxSeconds" << maxSeconds;
+  }
+
+  virtual std::string getDefaultName() const { return "VerificationParameters"; }
+
+public:
+  // matches whose source and reference points are both within this tolerance in pixels
+  // are regarded as duplicates of the same physical point detected in several views,
+  // and only the most distinctive one is verified. disabled if <= 0.
+  double duplicateTolerance;
+  // bin widths of the hough voting of similarities given by keypoint frames.
+  // rotation in degrees, scale in log2 and location relative to the extent of reference keypoints.
+  // the voting is disabled if houghAngleBin <= 0.
+  double houghAngleBin;
+  double houghScaleBin;
+  double houghLocationBin;
+  // correspondences in bins with votes >= houghMinVoteRatio * max votes survive the voting
+  double houghMinVoteRatio;
+  // number of correspondences to hypothesize a transform.
+  // 4: a homography from 4 points.
+  // 2: a similarity from 2 points.
+  // 1: a similarity from the position, size and orientation of a pair of keypoints.
+  // hypotheses by 1 or 2 correspondences need much fewer iterations
+  // and are refined to a homography on their inliers.
+  int sampleSize;
+  // max reprojection error of inliers in pixels
+  double reprojThreshold;
+  // probability that at least one outlier-free sample has been drawn on termination
+  double confidence;
+  int maxIterations;
+  // time limit of a verification. no limit if <= 0.
+  double maxSeconds;
+};
+
+//
+// Statistics of a verification
+//
+
+struct VerificationReport {
+public:
+  VerificationReport()
+      : duplicates(0), voted(0), iterations(0), inliers(0), seconds(0.), timedOut(false) {}
+
+public:
+  // number of correspondences collapsed into others as duplicates
+  int duplicates;
+  // number of correspondences survived the hough voting
+  int voted;
+  int iterations;
+  int inliers;
+  double seconds;
+  bool timedOut;
+};
+
+//
+// Robust homography estimation by PROSAC (progressive sample consensus).
+// Samples are drawn from the most promising correspondences first
+// and the sampling set grows progressively to all correspondences,
+// which finds a good hypothesis in far fewer iterations than RANSAC
+// when correspondences are sorted by their quality.
+// The best hypothesis is refined to a homography by least squares on its inliers
+// until the number of inliers stops increasing.
+// Optionally, correspondences inconsistent with the dominant similarities are rejected
+// by hough voting before sampling, as in Lowe's object recognition with SIFT.
+//
+
+class GeometricVerifier {
+public:
+  GeometricVerifier(const VerificationParameters &params = VerificationParameters())
+      : params_(params) {}
+
+  virtual ~GeometricVerifier() {}
+
+  const VerificationParameters &getParameters() const { return params_; }
+
+  void setParameters(const VerificationParameters &params) { params_ = params; }
+
+  // estimate a homography from source to reference keypoints.
+  // correspondences must be sorted in descending order of their quality.
+  // return false if no homography supported by 4 or more inliers is found.
+  bool verify(const std::vector< cv::KeyPoint > &source_keypoints,
+              const std::vector< cv::KeyPoint > &reference_keypoints, cv::Matx33f &transform,
+              std::vector< unsigned char > &mask, VerificationReport *report = NULL) const {
+    CV_Assert(source_keypoints.size() == reference_keypoints.size());
+    CV_Assert(params_.sampleSize == 1 || params_.sampleSize == 2 || params_.sampleSize == 4);
+
+    const int64 start(cv::getTickCount());
+    VerificationReport stats;
+    bool found(false);
+    {
+      // draw samples from correspondences survived the voting
+      std::vector< int > survivors;
+      vote(source_keypoints, reference_keypoints, survivors);
+      std::vector< cv::KeyPoint > voted_source, voted_reference;
+      for (std::vector< int >::const_iterator i = survivors.begin(); i != survivors.end(); ++i) {
+        voted_source.push_back(source_keypoints[*i]);
+        voted_reference.push_back(reference_keypoints[*i]);
+      }
+      stats.voted = survivors.size();
+
+      // refine the best hypothesis on all correspondences
+      // so that ones wrongly rejected by the voting can be inliers
+      cv::Matx33d homography;
+      if (estimate(voted_source, voted_reference, start, homography, stats)) {
+        found = refine(source_keypoints, reference_keypoints, homography, mask, stats);
+        transform = homography;
+      } else {
+        mask.assign(source_keypoints.size(), 0);
+      }
+    }
+    stats.seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    if (report) {
+      *report = stats;
+    }
+    return found;
+  }
+
+protected:
+  // a bin in the hough space and an index of a voting correspondence
+  typedef std::pair< cv::Vec4i, int > Vote;
+
+  // select correspondences whose similarities given by keypoint frames belong to dominant bins.
+  // each correspondence votes for the 2 closest bins in each dimension.
+  // survivors are sorted in ascending order.
+  void vote(const std::vector< cv::KeyPoint > &source_keypoints,
+            const std::vector< cv::KeyPoint > &reference_keypoints,
+            std::vector< int > &survivors) const {
+    // a bin is dominant if it is supported by 3 or more correspondences at least
+    static const int min_votes(3);
+    const int npoints(source_keypoints.size());
+    survivors.clear();
+    if (params_.houghAngleBin <= 0.) {
+      for (int i = 0; i < npoints; ++i) {
+        survivors.push_back(i);
+      }
+      return;
+    }
+
+    // width of location bins
+    float min_x(FLT_MAX), min_y(FLT_MAX), max_x(-FLT_MAX), max_y(-FLT_MAX);
+    for (int i = 0; i < npoints; ++i) {
+      const cv::Point2f &pt(reference_keypoints[i].pt);
+      min_x = std::min(min_x, pt.x);
+      min_y = std::min(min_y, pt.y);
+      max_x = std::max(max_x, pt.x);
+      max_y = std::max(max_y, pt.y);
+    }
+    const double location_bin(params_.houghLocationBin *
+                              std::max< double >(std::max(max_x - min_x, max_y - min_y), 1.));
+    // rotation bins wrap around
+    const int nangles(std::max(cvRound(360. / params_.houghAngleBin), 1));
+
+    std::vector< Vote > votes;
+    for (int i = 0; i < npoints; ++i) {
+      cv::Matx33d similarity;
+      if (!frameSimilarity(source_keypoints[i], reference_keypoints[i], similarity)) {
+        continue;
+      }
+      const double coords[4] = {
+          std::atan2(similarity(1, 0), similarity(0, 0)) * 180. / CV_PI * nangles / 360.,
+          std::log(std::sqrt(similarity(0, 0) * similarity(0, 0) +
+                             similarity(1, 0) * similarity(1, 0))) /
+              std::log(2.) / params_.houghScaleBin,
+          similarity(0, 2) / location_bin, similarity(1, 2) / location_bin};
+      int bins[4][2];
+      for (int d = 0; d < 4; ++d) {
+        bins[d][0] = cvFloor(coords[d]);
+        bins[d][1] = coords[d] - bins[d][0] < 0.5 ? bins[d][0] - 1 : bins[d][0] + 1;
+      }
+      for (int v = 0; v < 16; ++v) {
+        cv::Vec4i bin;
+        for (int d = 0; d < 4; ++d) {
+          bin[d] = bins[d][(v >> d) & 1];
+        }
+        bin[0] = ((bin[0] % nangles) + nangles) % nangles;
+        votes.push_back(Vote(bin, i));
+      }
+    }
+
+    // count votes in each bin. a correspondence votes for a bin once
+    // even if its closest bins are wrapped to the same one.
+    std::sort(votes.begin(), votes.end(), lessVote);
+    votes.erase(std::unique(votes.begin(), votes.end()), votes.end());
+    std::vector< std::pair< std::size_t, std::size_t > > runs;
+    std::size_t max_votes(0);
+    for (std::size_t begin = 0, end = 0; begin < votes.size(); begin = end) {
+      while (end < votes.size() && votes[end].first == votes[begin].first) {
+        ++end;
+      }
+      runs.push_back(std::make_pair(begin, end));
+      max_votes = std::max(max_votes, end - begin);
+    }
+
+    // keep correspondences in dominant bins
+    const double threshold(std::max< double >(params_.houghMinVoteRatio * max_votes, min_votes));
+    std::vector< unsigned char > keep(npoints, 0);
+    for (std::size_t r = 0; r < runs.size(); ++r) {
+      if (runs[r].second - runs[r].first < threshold) {
+        continue;
+      }
+      for (std::size_t v = runs[r].first; v < runs[r].second; ++v) {
+        keep[votes[v].second] = 1;
+      }
+    }
+    for (int i = 0; i < npoints; ++i) {
+      if (keep[i] != 0) {
+        survivors.push_back(i);
+      }
+    }
+  }
+
+  static bool lessVote(const Vote &a, const Vote &b) {
+    if (a.first != b.first) {
+      return std::lexicographical_compare(a.first.val, a.first.val + 4, b.first.val,
+                                          b.first.val + 4);
+    }
+    return a.second < b.second;
+  }
+
+  // find the best hypothesis by PROSAC
+  bool estimate(const std::vector< cv::KeyPoint > &source_keypoints,
+                const std::vector< cv::KeyPoint > &reference_keypoints, const int64 start,
+                cv::Matx33d &transform, VerificationReport &stats) const {
+    const int sample_size(params_.sampleSize);
+    const int npoints(source_keypoints.size());
+    if (npoints < min_inliers) {
+      return false;
+    }
+
+    std::vector< cv::Point2f > source_points, reference_points;
+    cv::KeyPoint::convert(source_keypoints, source_points);
+    cv::KeyPoint::convert(reference_keypoints, reference_points);
+
+    // the number of samples drawn from the whole set before the sampling set grows
+    double growth_iterations(params_.maxIterations);
+    for (int i = 0; i < sample_size; ++i) {
+      growth_iterations *= static_cast< double >(sample_size - i) / (npoints - i);
+    }
+    int growth_iteration(1);
+    int nsamplings(sample_size);
+
+    cv::RNG rng(0x12345678);
+    cv::Matx33d best_homography;
+    int best_inliers(0);
+    int max_iterations(params_.maxIterations);
+    const double tick_limit(params_.maxSeconds * cv::getTickFrequency());
+    for (stats.iterations = 0; stats.iterations < max_iterations; ++stats.iterations) {
+      if (params_.maxSeconds > 0. && cv::getTickCount() - start > tick_limit) {
+        stats.timedOut = true;
+        break;
+      }
+
+      // grow the sampling set progressively
+      const int t(stats.iterations + 1);
+      if (t > growth_iteration && nsamplings < npoints) {
+        const double next_growth_iterations(growth_iterations * (nsamplings + 1) /
+                                            (nsamplings + 1 - sample_size));
+        growth_iteration += std::ceil(next_growth_iterations - growth_iterations);
+        growth_iterations = next_growth_iterations;
+        ++nsamplings;
+      }
+
+      // draw a sample including the newest correspondence in the sampling set,
+      // or a sample from the whole sampling set once its growth schedule is exceeded
+      int sample[4];
+      const bool include_newest(t <= growth_iteration);
+      if (!drawSample(rng, nsamplings, sample_size, include_newest, sample)) {
+        continue;
+      }
+
+      cv::Matx33d homography;
+      if (!hypothesize(source_keypoints, reference_keypoints, sample, sample_size, homography)) {
+        continue;
+      }
+      const int inliers(countInliers(homography, source_points, reference_points));
+      if (inliers > best_inliers) {
+        best_inliers = inliers;
+        best_homography = homography;
+        max_iterations = std::min(
+            max_iterations, requiredIterations(static_cast< double >(inliers) / npoints,
+                                               sample_size, params_.maxIterations));
+      }
+    }
+
+    if (best_inliers < min_inliers) {
+      return false;
+    }
+    transform = best_homography;
+    return true;
+  }
+
+  // refine the hypothesis to a homography by least squares on its inliers
+  // until the number of inliers stops increasing
+  bool refine(const std::vector< cv::KeyPoint > &source_keypoints,
+              const std::vector< cv::KeyPoint > &reference_keypoints, cv::Matx33d &transform,
+              std::vector< unsigned char > &mask, VerificationReport &stats) const {
+    static const int max_refinements(5);
+    const int npoints(source_keypoints.size());
+
+    std::vector< cv::Point2f > source_points, reference_points;
+    cv::KeyPoint::convert(source_keypoints, source_points);
+    cv::KeyPoint::convert(reference_keypoints, reference_points);
+
+    cv::Matx33d best_homography(transform);
+    int best_inliers(countInliers(best_homography, source_points, reference_points, &mask));
+    for (int r = 0; r < max_refinements && best_inliers >= min_inliers; ++r) {
+      std::vector< cv::Point2f > inlier_source, inlier_reference;
+      for (int i = 0; i < npoints; ++i) {
+        if (mask[i] != 0) {
+          inlier_source.push_back(source_points[i]);
+          inlier_reference.push_back(reference_points[i]);
+        }
+      }
+      cv::Mat refined;
+      try {
+        refined = cv::findHomography(inlier_source, inlier_reference, 0);
+      } catch (const cv::Exception & /* error */) {
+        // keep the best hypothesis if the refinement fails
+      }
+      if (refined.empty()) {
+        break;
+      }
+      std::vector< unsigned char > refined_mask;
+      const cv::Matx33d refined_homography(refined);
+      const int refined_inliers(
+          countInliers(refined_homography, source_points, reference_points, &refined_mask));
+      if (refined_inliers < best_inliers) {
+        break;
+      }
+      const bool grown(refined_inliers > best_inliers);
+      best_inliers = refined_inliers;
+      best_homography = refined_homography;
+      mask.swap(refined_mask);
+      if (!grown) {
+        break;
+      }
+    }
+
+    transform = best_homography;
+    stats.inliers = best_inliers;
+    return best_inliers >= min_inliers;
+  }
+
+  // draw distinct indices from [0, nsamplings). the last index is nsamplings - 1
+  // if include_newest is true.
+  static bool drawSample(cv::RNG &rng, const int nsamplings, const int sample_size,
+                         const bool include_newest, int *sample) {
+    static const int max_attempts(100);
+    int n(0);
+    if (include_newest) {
+      sample[n++] = nsamplings - 1;
+    }
+    for (int attempt = 0; n < sample_size && attempt < max_attempts; ++attempt) {
+      const int index(rng.uniform(0, include_newest ? nsamplings - 1 : nsamplings));
+      if (std::find(sample, sample + n, index) == sample + n) {
+        sample[n++] = index;
+      }
+    }
+    return n == sample_size;
+  }
+
+  // hypothesize a transform from source to reference by the sampled correspondences.
+  // return false if the sample is degenerate.
+  static bool hypothesize(const std::vector< cv::KeyPoint > &source_keypoints,
+                          const std::vector< cv::KeyPoint > &reference_keypoints,
+                          const int *sample, const int sample_size, cv::Matx33d &transform) {
+    switch (sample_size) {
+    case 1:
+      return frameSimilarity(source_keypoints[sample[0]], reference_keypoints[sample[0]],
+                             transform);
+    case 2:
+      return pointSimilarity(source_keypoints[sample[0]].pt, source_keypoints[sample[1]].pt,
+                             reference_keypoints[sample[0]].pt, reference_keypoints[sample[1]].pt,
+                             transform);
+    }
+
+    cv::Point2f source[4], reference[4];
+    for (int i = 0; i < 4; ++i) {
+      source[i] = source_keypoints[sample[i]].pt;
+      reference[i] = reference_keypoints[sample[i]].pt;
+    }
+    if (isDegenerate(source, reference)) {
+      return false;
+    }
+    transform = cv::getPerspectiveTransform(source, reference);
+    return true;
+  }
+
+  // a similarity which maps the source keypoint frame to the reference one.
+  // note that sizes and angles of affine invariant keypoints are those in their simulated views,
+  // so the similarity is an approximation to be refined on its inliers.
+  static bool frameSimilarity(const cv::KeyPoint &source, const cv::KeyPoint &reference,
+                              cv::Matx33d &transform) {
+    if (source.size <= 0.f || reference.size <= 0.f) {
+      return false;
+    }
+    const double scale(reference.size / source.size);
+    // keypoints without orientation are assumed to be upright
+    const double angle(source.angle >= 0.f && reference.angle >= 0.f
+                           ? (reference.angle - source.angle) * CV_PI / 180.
+                           : 0.);
+    const double a(scale * std::cos(angle)), b(scale * std::sin(angle));
+    transform = cv::Matx33d(a, -b, reference.pt.x - (a * source.pt.x - b * source.pt.y), // 1st row
+                            b, a, reference.pt.y - (b * source.pt.x + a * source.pt.y),  // 2nd row
+                            0., 0., 1.);
+    return true;
+  }
+
+  // a similarity which maps 2 source points to 2 reference points
+  static bool pointSimilarity(const cv::Point2f &source0, const cv::Point2f &source1,
+                              const cv::Point2f &reference0, const cv::Point2f &reference1,
+                              cv::Matx33d &transform) {
+    const cv::Point2d source_diff(source1 - source0), reference_diff(reference1 - reference0);
+    const double source_norm2(source_diff.dot(source_diff));
+    const double reference_norm2(reference_diff.dot(reference_diff));
+    if (source_norm2 < 1. || reference_norm2 < 1.) {
+      return false;
+    }
+    // (a + ib) = reference_diff / source_diff as complex numbers
+    const double a(source_diff.dot(reference_diff) / source_norm2);
+    const double b(source_diff.cross(reference_diff) / source_norm2);
+    transform = cv::Matx33d(a, -b, reference0.x - (a * source0.x - b * source0.y), // 1st row
+                            b, a, reference0.y - (b * source0.x + a * source0.y),  // 2nd row
+                            0., 0., 1.);
+    return true;
+  }
+
+  // a sample is degenerate if any 3 points are collinear
+  // or the orientation of any 3 points is flipped by the transform
+  static bool isDegenerate(const cv::Point2f *source, const cv::Point2f *reference) {
+    static const int triplets[4][3] = {{0, 1, 2}, {0, 1, 3}, {0, 2, 3}, {1, 2, 3}};
+    for (int i = 0; i < 4; ++i) {
+      const int a(triplets[i][0]), b(triplets[i][1]), c(triplets[i][2]);
+      const double source_cross((source[b].x - source[a].x) * (source[c].y - source[a].y) -
+                                (source[b].y - source[a].y) * (source[c].x - source[a].x));
+      const double reference_cross(
+          (reference[b].x - reference[a].x) * (reference[c].y - reference[a].y) -
+          (reference[b].y - reference[a].y) * (reference[c].x - reference[a].x));
+      if (source_cross * reference_cross <= 0.) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int countInliers(const cv::Matx33d &homography, const std::vector< cv::Point2f > &source_points,
+                   const std::vector< cv::Point2f > &reference_points,
+                   std::vector< unsigned char > *mask = NULL) const {
+    const double threshold2(params_.reprojThreshold * params_.reprojThreshold);
+    if (mask) {
+      mask->assign(source_points.size(), 0);
+    }
+    int inliers(0);
+    for (std::size_t i = 0; i < source_points.size(); ++i) {
+      const cv::Point2f &src(source_points[i]);
+      const double w(homography(2, 0) * src.x + homography(2, 1) * src.y + homography(2, 2));
+      if (std::fabs(w) < DBL_EPSILON) {
+        continue;
+      }
+      const double dx(
+          (homography(0, 0) * src.x + homography(0, 1) * src.y + homography(0, 2)) / w -
+          reference_points[i].x);
+      const double dy(
+          (homography(1, 0) * src.x + homography(1, 1) * src.y + homography(1, 2)) / w -
+          reference_points[i].y);
+      if (dx * dx + dy * dy <= threshold2) {
+        ++inliers;
+        if (mask) {
+          (*mask)[i] = 1;
+        }
+      }
+    }
+    return inliers;
+  }
+
+  // the number of iterations to draw at least one outlier-free sample with the confidence
+  int requiredIterations(const double inlier_ratio, const int sample_size,
+                         const int max_iterations) const {
+    const double outlier_free(std::pow(inlier_ratio, sample_size));
+    if (outlier_free >= 1.) {
+      return 0;
+    }
+    if (outlier_free <= 0.) {
+      return max_iterations;
+    }
+    const double iterations(std::log(1. - params_.confidence) / std::log(1. - outlier_free));
+    return iterations < max_iterations ? static_cast< int >(std::ceil(iterations))
+                                       : max_iterations;
+  }
+
+protected:
+  // 4 inliers are required to fit the final homography
+  static const int min_inliers = 4;
+
+  VerificationParameters params_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
@@ -0,0 +1,137 @@
+#ifndef AFFINE_INVARIANT_FEATURES_HASH
+#define AFFINE_INVARIANT_FEATURES_HASH
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+namespace affine_invariant_features {
+
+// initial value of FNV-1a hashes
+static const boost::uint64_t fnv1a64_basis(UINT64_C(0xcbf29ce484222325));
+
+// 64-bit FNV-1a hash of bytes.
+// bytes can be hashed piece by piece by giving the hash of the last piece as the seed.
+static inline boost::uint64_t fnv1a64(const void *data, const std::size_t size,
+                                      const boost::uint64_t seed = fnv1a64_basis) {
+  static const boost::uint64_t prime(UINT64_C(0x100000001b3));
+  const unsigned char *const bytes(static_cast< const unsigned char * >(data));
+  boost::uint64_t hash(seed);
+  for (std::size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * prime;
+  }
+  return hash;
+}
+
+// hash of the bytes of a value of a plain type.
+// give the type explicitly to hash the same bytes on any platform.
+template < typename T >
+static inline boost::uint64_t fnv1a64Value(const T &value,
+                                           const boost::uint64_t seed = fnv1a64_basis) {
+  return fnv1a64(&value, sizeof(T), seed);
+}
+
+// hash of a string with its length, which distinguishes concatenations of strings
+static inline boost::uint64_t fnv1a64Value(const std::string &value,
+                                           const boost::uint64_t seed = fnv1a64_basis) {
+  return fnv1a64(value.data(), value.size(),
+                 fnv1a64Value< boost::uint64_t >(value.size(), seed));
+}
+
+//
+// XXH64, a fast non-cryptographic hash (https://github.com/Cyan4973/xxHash).
+// input is read in the native byte order, which gives the reference hash on little endian.
+//
+
+namespace xxh64_detail {
+
+static const boost::uint64_t prime1(UINT64_C(0x9E3779B185EBCA87));
+static const boost::uint64_t prime2(UINT64_C(0xC2B2AE3D27D4EB4F));
+static const boost::uint64_t prime3(UINT64_C(0x165667B19E3779F9));
+static const boost::uint64_t prime4(UINT64_C(0x85EBCA77C2B2AE63));
+static const boost::uint64_t prime5(UINT64_C(0x27D4EB2F165667C5));
+
+static inline boost::uint64_t rotl(const boost::uint64_t x, const int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline boost::uint64_t read64(const unsigned char *p) {
+  boost::uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline boost::uint32_t read32(const unsigned char *p) {
+  boost::uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline boost::uint64_t round(boost::uint64_t acc, const boost::uint64_t input) {
+  acc += input * prime2;
+  acc = rotl(acc, 31);
+  return acc * prime1;
+}
+
+static inline boost::uint64_t mergeRound(const boost::uint64_t acc, const boost::uint64_t val) {
+  return (acc ^ round(0, val)) * prime1 + prime4;
+}
+
+} // namespace xxh64_detail
+
+static inline boost::uint64_t xxh64(const void *data, const std::size_t size,
+                                    const boost::uint64_t seed = 0) {
+  using namespace xxh64_detail;
+
+  const unsigned char *p(static_cast< const unsigned char * >(data));
+  const unsigned char *const end(p + size);
+  boost::uint64_t hash;
+
+  // 32-byte stripes into 4 accumulators
+  if (size >= 32) {
+    boost::uint64_t v1(seed + prime1 + prime2), v2(seed + prime2), v3(seed), v4(seed - prime1);
+    for (; p + 32 <= end; p += 32) {
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+    }
+    hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    hash = mergeRound(hash, v1);
+    hash = mergeRound(hash, v2);
+    hash = mergeRound(hash, v3);
+    hash = mergeRound(hash, v4);
+  } else {
+    hash = seed + prime5;
+  }
+  hash += size;
+
+  // remaining bytes
+  for (; p + 8 <= end; p += 8) {
+    hash ^= round(0, read64(p));
+    hash = rotl(hash, 27) * prime1 + prime4;
+  }
+  if (p + 4 <= end) {
+    hash ^= read32(p) * prime1;
+    hash = rotl(hash, 23) * prime2 + prime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    hash ^= *p * prime5;
+    hash = rotl(hash, 11) * prime1;
+  }
+
+  // avalanche
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  hash *= prime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
@@ -0,0 +1,394 @@
+#ifndef AFFINE_INVARIANT_FEATURES_HNSW_MATCHER
+#define AFFINE_INVARIANT_FEATURES_HNSW_MATCHER
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <affine_invariant_features/visited_list.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A matcher on a hierarchical navigable small world graph (HNSW) for NORM_L2 descriptors.
+// Descriptors can be inserted incrementally by add() and train() at any time.
+//
+
+class HNSWMatcher : public cv::DescriptorMatcher {
+protected:
+  // a pair of a squared distance and a descriptor id
+  typedef std::pair< float, int > Candidate;
+
+public:
+  HNSWMatcher(const int M = 16, const int efConstruction = 100, const int efSearch = 64)
+      : M_(M), ef_construction_(efConstruction), ef_search_(efSearch), dims_(0), entry_(-1),
+        max_level_(-1), offsets_(1, 0) {
+    CV_Assert(M_ > 1);
+  }
+
+  virtual ~HNSWMatcher() {}
+
+  static cv::Ptr< HNSWMatcher > create(const int M = 16, const int efConstruction = 100,
+                                       const int efSearch = 64) {
+    return new HNSWMatcher(M, efConstruction, efSearch);
+  }
+
+  // the size of dynamic candidate lists on search, which trades recall for speed
+  void setEfSearch(const int efSearch) { ef_search_ = efSearch; }
+
+  int getEfSearch() const { return ef_search_; }
+
+  //
+  // overloaded functions from cv::DescriptorMatcher or its base class
+  //
+
+  virtual void clear() {
+    cv::DescriptorMatcher::clear();
+    dims_ = 0;
+    entry_ = -1;
+    max_level_ = -1;
+    rows_.clear();
+    links_.clear();
+    offsets_.assign(1, 0);
+  }
+
+  virtual bool isMaskSupported() const { return false; }
+
+  virtual void train() {
+    // insert descriptors added after the last training
+    if (trainDescCollection.size() + 1 <= offsets_.size()) {
+      return;
+    }
+
+    const int first_id(offsets_.back());
+    appendRows();
+
+    VisitedList visited(rows_.size());
+    for (int id = first_id; id < static_cast< int >(rows_.size()); ++id) {
+      insert(id, visited);
+    }
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    clear();
+    fn["M"] >> M_;
+    fn["efConstruction"] >> ef_construction_;
+    fn["efSearch"] >> ef_search_;
+    fn["entry"] >> entry_;
+    fn["maxLevel"] >> max_level_;
+
+    // descriptors are stored with the graph because searching the graph requires them
+    const cv::FileNode descriptors_node(fn["descriptors"]);
+    trainDescCollection.resize(descriptors_node.isSeq() ? descriptors_node.size() : 0);
+    for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+      descriptors_node[i] >> trainDescCollection[i];
+    }
+    appendRows();
+
+    // links are stored flatten as (nlevels, (nlinks, ids...) for each level) for each descriptor
+    std::vector< int > flat_links;
+    fn["links"] >> flat_links;
+    links_.resize(rows_.size());
+    std::vector< int >::const_iterator value(flat_links.begin());
+    for (std::size_t id = 0; id < links_.size(); ++id) {
+      CV_Assert(value != flat_links.end());
+      links_[id].resize(*value++);
+      for (std::size_t level = 0; level < links_[id].size(); ++level) {
+        CV_Assert(value != flat_links.end());
+        const int nlinks(*value++);
+        CV_Assert(flat_links.end() - value >= nlinks);
+        links_[id][level].assign(value, value + nlinks);
+        value += nlinks;
+      }
+    }
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "M" << M_;
+    fs << "efConstruction" << ef_construction_;
+    fs << "efSearch" << ef_search_;
+    fs << "entry" << entry_;
+    fs << "maxLevel" << max_level_;
+    fs << "descriptors";
+    fs << "[";
+    for (std::size_t i = 0; i + 1 < offsets_.size(); ++i) {
+      fs << trainDescCollection[i];
+    }
+    fs << "]";
+    std::vector< int > flat_links;
+    for (std::size_t id = 0; id < links_.size(); ++id) {
+      flat_links.push_back(links_[id].size());
+      for (std::size_t level = 0; level < links_[id].size(); ++level) {
+        flat_links.push_back(links_[id][level].size());
+        flat_links.insert(flat_links.end(), links_[id][level].begin(), links_[id][level].end());
+      }
+    }
+    fs << "links" << flat_links;
+  }
+
+  virtual cv::Ptr< cv::DescriptorMatcher > clone(const bool emptyTrainData = false) const {
+    const cv::Ptr< HNSWMatcher > matcher(new HNSWMatcher(M_, ef_construction_, ef_search_));
+    if (!emptyTrainData) {
+      // descriptors are shared as they are never modified
+      matcher->trainDescCollection = trainDescCollection;
+      matcher->dims_ = dims_;
+      matcher->entry_ = entry_;
+      matcher->max_level_ = max_level_;
+      matcher->rows_ = rows_;
+      matcher->links_ = links_;
+      matcher->offsets_ = offsets_;
+    }
+    return matcher;
+  }
+
+  virtual cv::String getDefaultName() const { return "HNSWMatcher"; }
+
+protected:
+  virtual void knnMatchImpl(cv::InputArray queryDescriptors,
+                            std::vector< std::vector< cv::DMatch > > &matches, int k,
+                            cv::InputArrayOfArrays /* masks */, bool /* compactResult */) {
+    const cv::Mat query(queryDescriptors.getMat());
+
+    matches.clear();
+    matches.resize(query.rows);
+    if (entry_ < 0) {
+      return;
+    }
+    CV_Assert(query.type() == CV_32FC1 && query.cols == dims_);
+
+    VisitedList visited(rows_.size());
+    std::vector< Candidate > candidates;
+    for (int i = 0; i < query.rows; ++i) {
+      search(query.ptr< float >(i), std::max(ef_search_, k), visited, candidates);
+      for (int c = 0; c < k && c < static_cast< int >(candidates.size()); ++c) {
+        matches[i].push_back(toDMatch(i, candidates[c]));
+      }
+    }
+  }
+
+  // approximate. only descriptors in the dynamic candidate list of efSearch are examined.
+  virtual void radiusMatchImpl(cv::InputArray queryDescriptors,
+                               std::vector< std::vector< cv::DMatch > > &matches,
+                               float maxDistance, cv::InputArrayOfArrays /* masks */,
+                               bool /* compactResult */) {
+    const cv::Mat query(queryDescriptors.getMat());
+
+    matches.clear();
+    matches.resize(query.rows);
+    if (entry_ < 0) {
+      return;
+    }
+    CV_Assert(query.type() == CV_32FC1 && query.cols == dims_);
+
+    VisitedList visited(rows_.size());
+    std::vector< Candidate > candidates;
+    for (int i = 0; i < query.rows; ++i) {
+      search(query.ptr< float >(i), ef_search_, visited, candidates);
+      for (std::size_t c = 0; c < candidates.size(); ++c) {
+        const cv::DMatch match(toDMatch(i, candidates[c]));
+        if (match.distance > maxDistance) {
+          break;
+        }
+        matches[i].push_back(match);
+      }
+    }
+  }
+
+  // register row pointers of descriptors added after the last training
+  void appendRows() {
+    for (std::size_t i = offsets_.size() - 1; i < trainDescCollection.size(); ++i) {
+      const cv::Mat &descriptors(trainDescCollection[i]);
+      // an image without descriptors takes no ids
+      if (descriptors.empty()) {
+        offsets_.push_back(rows_.size());
+        continue;
+      }
+      CV_Assert(descriptors.type() == CV_32FC1);
+      CV_Assert(rows_.empty() || descriptors.cols == dims_);
+      dims_ = descriptors.cols;
+      for (int r = 0; r < descriptors.rows; ++r) {
+        rows_.push_back(descriptors.ptr< float >(r));
+      }
+      offsets_.push_back(rows_.size());
+    }
+  }
+
+  void insert(const int id, VisitedList &visited) {
+    // draw the top level of the new descriptor from an exponentially decaying distribution
+    const int level(std::floor(-std::log(1. - rng_.uniform(0., 1.)) / std::log(double(M_))));
+    links_.resize(rows_.size());
+    links_[id].resize(level + 1);
+
+    // the first descriptor becomes the entry point
+    if (entry_ < 0) {
+      entry_ = id;
+      max_level_ = level;
+      return;
+    }
+
+    // greedily descend to the top level of the new descriptor
+    const float *const query(rows_[id]);
+    std::vector< Candidate > nearest(1, Candidate(distance(query, rows_[entry_]), entry_));
+    for (int l = max_level_; l > level; --l) {
+      searchLayer(query, 1, l, visited, nearest);
+    }
+
+    // connect the new descriptor to neighbors at each level
+    for (int l = std::min(level, max_level_); l >= 0; --l) {
+      searchLayer(query, ef_construction_, l, visited, nearest);
+      std::vector< Candidate > sorted(nearest);
+      std::sort(sorted.begin(), sorted.end());
+      selectNeighbors(sorted, M_, links_[id][l]);
+      for (std::vector< int >::const_iterator neighbor = links_[id][l].begin();
+           neighbor != links_[id][l].end(); ++neighbor) {
+        connect(*neighbor, id, l);
+      }
+    }
+
+    if (level > max_level_) {
+      entry_ = id;
+      max_level_ = level;
+    }
+  }
+
+  // add a link from src to dst, shrinking links of src if they exceed the limit
+  void connect(const int src, const int dst, const int level) {
+    std::vector< int > &links(links_[src][level]);
+    const std::size_t max_links(level == 0 ? 2 * M_ : M_);
+    if (links.size() < max_links) {
+      links.push_back(dst);
+      return;
+    }
+
+    std::vector< Candidate > candidates;
+    candidates.push_back(Candidate(distance(rows_[src], rows_[dst]), dst));
+    for (std::vector< int >::const_iterator link = links.begin(); link != links.end(); ++link) {
+      candidates.push_back(Candidate(distance(rows_[src], rows_[*link]), *link));
+    }
+    std::sort(candidates.begin(), candidates.end());
+    selectNeighbors(candidates, max_links, links);
+  }
+
+  // select diverse neighbors from the sorted candidates. a candidate is skipped
+  // if it is closer to an already selected neighbor than to the base descriptor.
+  void selectNeighbors(const std::vector< Candidate > &candidates, const std::size_t max_neighbors,
+                       std::vector< int > &neighbors) const {
+    neighbors.clear();
+    for (std::vector< Candidate >::const_iterator c = candidates.begin();
+         c != candidates.end() && neighbors.size() < max_neighbors; ++c) {
+      bool diverse(true);
+      for (std::vector< int >::const_iterator n = neighbors.begin(); n != neighbors.end(); ++n) {
+        if (distance(rows_[c->second], rows_[*n]) < c->first) {
+          diverse = false;
+          break;
+        }
+      }
+      if (diverse) {
+        neighbors.push_back(c->second);
+      }
+    }
+  }
+
+  // find the ef nearest descriptors at the given level starting from the given entry points.
+  // the result is stored in nearest as a max-heap.
+  void searchLayer(const float *query, const int ef, const int level, VisitedList &visited,
+                   std::vector< Candidate > &nearest) const {
+    visited.reset();
+    for (std::vector< Candidate >::const_iterator n = nearest.begin(); n != nearest.end(); ++n) {
+      visited.visit(n->second);
+    }
+
+    // candidates to be expanded in a min-heap
+    std::vector< Candidate > candidates(nearest);
+    std::make_heap(candidates.begin(), candidates.end(), std::greater< Candidate >());
+    std::make_heap(nearest.begin(), nearest.end());
+
+    while (!candidates.empty()) {
+      std::pop_heap(candidates.begin(), candidates.end(), std::greater< Candidate >());
+      const Candidate candidate(candidates.back());
+      candidates.pop_back();
+      if (nearest.size() >= static_cast< std::size_t >(ef) &&
+          candidate.first > nearest.front().first) {
+        break;
+      }
+
+      const std::vector< std::vector< int > > &levels(links_[candidate.second]);
+      if (level >= static_cast< int >(levels.size())) {
+        continue;
+      }
+      for (std::vector< int >::const_iterator link = levels[level].begin();
+           link != levels[level].end(); ++link) {
+        if (visited.visit(*link)) {
+          continue;
+        }
+        const Candidate neighbor(distance(query, rows_[*link]), *link);
+        if (nearest.size() < static_cast< std::size_t >(ef) || neighbor < nearest.front()) {
+          candidates.push_back(neighbor);
+          std::push_heap(candidates.begin(), candidates.end(), std::greater< Candidate >());
+          nearest.push_back(neighbor);
+          std::push_heap(nearest.begin(), nearest.end());
+          if (nearest.size() > static_cast< std::size_t >(ef)) {
+            std::pop_heap(nearest.begin(), nearest.end());
+            nearest.pop_back();
+          }
+        }
+      }
+    }
+  }
+
+  // find the ef nearest descriptors sorted by their distances
+  void search(const float *query, const int ef, VisitedList &visited,
+              std::vector< Candidate > &nearest) const {
+    nearest.clear();
+    if (entry_ < 0) {
+      return;
+    }
+    nearest.push_back(Candidate(distance(query, rows_[entry_]), entry_));
+    for (int l = max_level_; l > 0; --l) {
+      searchLayer(query, 1, l, visited, nearest);
+    }
+    searchLayer(query, ef, 0, visited, nearest);
+    std::sort_heap(nearest.begin(), nearest.end());
+  }
+
+  float distance(const float *a, const float *b) const {
+    float dist(0.f);
+    for (int i = 0; i < dims_; ++i) {
+      const float diff(a[i] - b[i]);
+      dist += diff * diff;
+    }
+    return dist;
+  }
+
+  cv::DMatch toDMatch(const int query_idx, const Candidate &candidate) const {
+    const int img(std::upper_bound(offsets_.begin(), offsets_.end(), candidate.second) -
+                  offsets_.begin() - 1);
+    return cv::DMatch(query_idx, candidate.second - offsets_[img], img,
+                      std::sqrt(candidate.first));
+  }
+
+protected:
+  int M_;
+  int ef_construction_;
+  int ef_search_;
+
+  cv::RNG rng_;
+  int dims_;
+  int entry_;
+  int max_level_;
+  // row pointers of all inserted descriptors, which are owned by trainDescCollection
+  std::vector< const float * > rows_;
+  // links of each descriptor at each level
+  std::vector< std::vector< std::vector< int > > > links_;
+  // the first id of each image and the total number of ids
+  std::vector< int > offsets_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
@@ -0,0 +1,165 @@
+#ifndef AFFINE_INVARIANT_FEATURES_IN_PLACE_FLANN_MATCHER
+#define AFFINE_INVARIANT_FEATURES_IN_PLACE_FLANN_MATCHER
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+#include <opencv2/flann.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A FLANN-based matcher which builds its index directly on the added descriptors.
+// cv::FlannBasedMatcher copies descriptors into its own merged matrix on training,
+// which doubles memory for every reference. This matcher shares the buffer of descriptors
+// with the caller (the buffer must not be modified while the matcher is alive),
+// and makes a merged copy only when descriptors of 2 or more images are added
+// or their rows are padded.
+//
+
+class InPlaceFlannMatcher : public cv::DescriptorMatcher {
+public:
+  InPlaceFlannMatcher(
+      const cv::Ptr< cv::flann::IndexParams > &indexParams = new cv::flann::KDTreeIndexParams(),
+      const cv::Ptr< cv::flann::SearchParams > &searchParams = new cv::flann::SearchParams())
+      : index_params_(indexParams), search_params_(searchParams), offsets_(1, 0) {
+    CV_Assert(index_params_ && search_params_);
+  }
+
+  virtual ~InPlaceFlannMatcher() {}
+
+  static cv::Ptr< InPlaceFlannMatcher > create(
+      const cv::Ptr< cv::flann::IndexParams > &indexParams = new cv::flann::KDTreeIndexParams(),
+      const cv::Ptr< cv::flann::SearchParams > &searchParams = new cv::flann::SearchParams()) {
+    return new InPlaceFlannMatcher(indexParams, searchParams);
+  }
+
+  //
+  // overloaded functions from cv::DescriptorMatcher or its base class
+  //
+
+  virtual void clear() {
+    cv::DescriptorMatcher::clear();
+    index_.release();
+    data_.release();
+    offsets_.assign(1, 0);
+  }
+
+  virtual bool isMaskSupported() const { return false; }
+
+  virtual void train() {
+    // rebuild the index if descriptors have been added after the last training
+    if (trainDescCollection.size() + 1 <= offsets_.size()) {
+      return;
+    }
+
+    offsets_.assign(1, 0);
+    for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+      offsets_.push_back(offsets_.back() + trainDescCollection[i].rows);
+    }
+    if (trainDescCollection.size() == 1 && trainDescCollection[0].isContinuous()) {
+      // share the buffer of descriptors. a Mat header keeps the buffer alive.
+      data_ = trainDescCollection[0];
+    } else if (trainDescCollection.size() == 1) {
+      // rows padded in the buffer (e.g. mapped from a file) are copied
+      // because the index requires continuous rows
+      data_ = trainDescCollection[0].clone();
+    } else {
+      cv::vconcat(trainDescCollection, data_);
+    }
+
+    index_ = new cv::flann::Index();
+    index_->build(data_, *index_params_,
+                  data_.depth() == CV_8U ? cvflann::FLANN_DIST_HAMMING : cvflann::FLANN_DIST_L2);
+  }
+
+  virtual cv::Ptr< cv::DescriptorMatcher > clone(const bool emptyTrainData = false) const {
+    const cv::Ptr< InPlaceFlannMatcher > matcher(
+        new InPlaceFlannMatcher(index_params_, search_params_));
+    if (!emptyTrainData) {
+      // the index is rebuilt because it cannot be copied
+      matcher->trainDescCollection = trainDescCollection;
+      matcher->train();
+    }
+    return matcher;
+  }
+
+  virtual cv::String getDefaultName() const { return "InPlaceFlannMatcher"; }
+
+protected:
+  virtual void knnMatchImpl(cv::InputArray queryDescriptors,
+                            std::vector< std::vector< cv::DMatch > > &matches, int k,
+                            cv::InputArrayOfArrays /* masks */, bool /* compactResult */) {
+    const cv::Mat query(queryDescriptors.getMat());
+    CV_Assert(index_ && query.type() == data_.type() && query.cols == data_.cols);
+
+    cv::Mat indices, dists;
+    index_->knnSearch(query, indices, dists, k, *search_params_);
+
+    matches.clear();
+    matches.resize(query.rows);
+    for (int i = 0; i < query.rows; ++i) {
+      for (int j = 0; j < k; ++j) {
+        const int id(indices.at< int >(i, j));
+        if (id < 0) {
+          break;
+        }
+        matches[i].push_back(toDMatch(i, id, distance(dists, i, j)));
+      }
+    }
+  }
+
+  virtual void radiusMatchImpl(cv::InputArray queryDescriptors,
+                               std::vector< std::vector< cv::DMatch > > &matches,
+                               float maxDistance, cv::InputArrayOfArrays /* masks */,
+                               bool /* compactResult */) {
+    const cv::Mat query(queryDescriptors.getMat());
+    CV_Assert(index_ && query.type() == data_.type() && query.cols == data_.cols);
+
+    // the L2 index works on squared distances
+    const double radius(data_.depth() == CV_8U ? maxDistance : maxDistance * maxDistance);
+
+    matches.clear();
+    matches.resize(query.rows);
+    for (int i = 0; i < query.rows; ++i) {
+      cv::Mat indices, dists;
+      const int nfound(index_->radiusSearch(query.row(i), indices, dists, radius, data_.rows,
+                                            *search_params_));
+      for (int j = 0; j < nfound && j < indices.cols; ++j) {
+        const int id(indices.at< int >(0, j));
+        if (id < 0) {
+          break;
+        }
+        matches[i].push_back(toDMatch(i, id, distance(dists, 0, j)));
+      }
+    }
+  }
+
+  // FLANN gives integer hamming distances or squared L2 distances
+  static float distance(const cv::Mat &dists, const int i, const int j) {
+    return dists.type() == CV_32S ? static_cast< float >(dists.at< int >(i, j))
+                                  : std::sqrt(dists.at< float >(i, j));
+  }
+
+  cv::DMatch toDMatch(const int query_idx, const int id, const float distance) const {
+    const int img(std::upper_bound(offsets_.begin(), offsets_.end(), id) - offsets_.begin() - 1);
+    return cv::DMatch(query_idx, id - offsets_[img], img, distance);
+  }
+
+protected:
+  const cv::Ptr< cv::flann::IndexParams > index_params_;
+  const cv::Ptr< cv::flann::SearchParams > search_params_;
+
+  cv::Ptr< cv::flann::Index > index_;
+  // indexed descriptors, which share the buffer with the added descriptors if possible
+  cv::Mat data_;
+  // the first id of each image and the total number of ids
+  std::vector< int > offsets_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
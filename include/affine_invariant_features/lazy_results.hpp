@@ -0,0 +1,243 @@
+#ifndef AFFINE_INVARIANT_FEATURES_LAZY_RESULTS
+#define AFFINE_INVARIANT_FEATURES_LAZY_RESULTS
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <affine_invariant_features/cv_serializable.hpp>
+#include <affine_invariant_features/feature_parameters.hpp>
+#include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/results_file.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// Results in a file whose keypoints are read on opening
+// but descriptors are mapped or decoded only on their first access.
+// Both the binary format and the FileStorage format are supported.
+// For the binary format, descriptors are not read at all until accessed.
+// For the FileStorage format, the whole document is parsed on opening as cv::FileStorage does
+// and only the conversion of descriptors into a matrix is deferred.
+//
+
+class LazyResults {
+public:
+  virtual ~LazyResults() {}
+
+  // return an empty pointer if the file cannot be opened or has no results.
+  // if expected_params_hash is not 0, results by other or unknown parameters are also refused.
+  static cv::Ptr< LazyResults > open(const std::string &path,
+                                     const boost::uint64_t expected_params_hash = 0) {
+    const cv::Ptr< LazyResults > results(new LazyResults(path));
+    const bool opened(isResultsFile(path) ? results->openBinary() : results->openFileStorage());
+    if (!opened ||
+        (expected_params_hash != 0 && results->getParamsHash() != expected_params_hash)) {
+      return cv::Ptr< LazyResults >();
+    }
+    return results;
+  }
+
+  const std::string &getPath() const { return path_; }
+
+  const std::vector< cv::KeyPoint > &getKeypoints() const { return keypoints_; }
+
+  int getNormType() const { return norm_type_; }
+
+  // hash of parameters which generated the results (FeatureParameters::hash()). 0 if unknown.
+  boost::uint64_t getParamsHash() const { return params_hash_; }
+
+  // shape of descriptors, which is available without loading them
+  int getDescriptorRows() const { return descriptor_rows_; }
+
+  int getDescriptorCols() const { return descriptor_cols_; }
+
+  int getDescriptorType() const { return descriptor_type_; }
+
+  bool isDescriptorsLoaded() const {
+    boost::lock_guard< boost::mutex > lock(mutex_);
+    return descriptors_loaded_;
+  }
+
+  // load descriptors if not yet. thread-safe.
+  // descriptors are empty if the file has been changed and cannot be mapped.
+  const cv::Mat &getDescriptors() const {
+    boost::lock_guard< boost::mutex > lock(mutex_);
+    if (!descriptors_loaded_) {
+      binary_ ? mapDescriptors() : decodeDescriptors();
+      descriptors_loaded_ = true;
+    }
+    return descriptors_;
+  }
+
+  // results sharing keypoints and descriptors with this object.
+  // the mapping of descriptors is alive while the returned results are alive.
+  cv::Ptr< MappedResults > getResults() const {
+    const cv::Mat &descriptors(getDescriptors());
+    const cv::Ptr< MappedResults > results(new MappedResults());
+    results->keypoints = keypoints_;
+    results->descriptors = descriptors;
+    results->normType = norm_type_;
+    results->region = region_;
+    results->paramsHash = params_hash_;
+    results->contourHash = contour_hash_;
+    return results;
+  }
+
+protected:
+  LazyResults(const std::string &path)
+      : path_(path), binary_(false), norm_type_(cv::NORM_L2), descriptor_rows_(0),
+        descriptor_cols_(0), descriptor_type_(CV_8UC1), params_hash_(0), contour_hash_(0),
+        descriptors_offset_(0),
+        descriptor_step_(0), descriptors_loaded_(false) {}
+
+  // read the header and keypoints. descriptors are not touched.
+  bool openBinary() {
+    std::ifstream ifs(path_.c_str(), std::ios::binary);
+    if (!ifs.seekg(0, std::ios::end)) {
+      return false;
+    }
+    const std::size_t size(ifs.tellg());
+    ifs.seekg(0, std::ios::beg);
+
+    ResultsFileHeader header;
+    if (!ifs.read(reinterpret_cast< char * >(&header), sizeof(header)) ||
+        !isValidHeader(header, size)) {
+      return false;
+    }
+
+    std::vector< KeyPointRecord > records(header.nKeypoints);
+    ifs.seekg(header.keypointsOffset, std::ios::beg);
+    if (!records.empty() && !ifs.read(reinterpret_cast< char * >(&records[0]),
+                                      records.size() * sizeof(KeyPointRecord))) {
+      return false;
+    }
+    readKeyPoints(records.empty() ? NULL : &records[0], records.size(), keypoints_);
+
+    binary_ = true;
+    norm_type_ = header.normType;
+    descriptor_rows_ = header.descriptorRows;
+    descriptor_cols_ = header.descriptorCols;
+    descriptor_type_ = header.descriptorType;
+    params_hash_ = header.paramsHash;
+    contour_hash_ = header.contourHash;
+    descriptors_offset_ = header.descriptorsOffset;
+    descriptor_step_ = header.descriptorStep;
+    return true;
+  }
+
+  // parse the file and read keypoints. descriptors are left as a file node.
+  bool openFileStorage() {
+    if (!fs_.open(path_, cv::FileStorage::READ)) {
+      return false;
+    }
+    const cv::FileNode node(fs_[Results().getDefaultName()]);
+    if (node.empty()) {
+      return false;
+    }
+
+    node["keypoints"] >> keypoints_;
+    node["normType"] >> norm_type_;
+    // parameters are optional
+    const cv::Ptr< const FeatureParameters > params(load< FeatureParameters >(fs_.root()));
+    params_hash_ = params ? params->hash() : 0;
+    descriptors_node_ = node["descriptors"];
+    if (!descriptors_node_.empty()) {
+      descriptors_node_["rows"] >> descriptor_rows_;
+      descriptors_node_["cols"] >> descriptor_cols_;
+      std::string dt;
+      descriptors_node_["dt"] >> dt;
+      descriptor_type_ = parseMatType(dt);
+      if (descriptor_type_ < 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // type of a matrix from its "dt" in a FileStorage document (e.g. "f", "3u").
+  // return -1 if unknown.
+  static int parseMatType(const std::string &dt) {
+    // depth characters in the order of depth values (CV_8U, CV_8S, ..., CV_64F)
+    static const std::string depths("ucwsifd");
+
+    std::size_t i(0);
+    int channels(0);
+    for (; i < dt.size() && dt[i] >= '0' && dt[i] <= '9' && channels <= CV_CN_MAX; ++i) {
+      channels = channels * 10 + (dt[i] - '0');
+    }
+    const std::size_t depth(i + 1 == dt.size() ? depths.find(dt[i]) : std::string::npos);
+    if (depth == std::string::npos || channels > CV_CN_MAX) {
+      return -1;
+    }
+    return CV_MAKETYPE(static_cast< int >(depth), std::max(channels, 1));
+  }
+
+  void mapDescriptors() const {
+    namespace bi = boost::interprocess;
+
+    if (descriptor_rows_ == 0) {
+      descriptors_.create(0, descriptor_cols_, descriptor_type_);
+      return;
+    }
+    try {
+      const bi::file_mapping mapping(path_.c_str(), bi::read_only);
+      region_.reset(new bi::mapped_region(mapping, bi::read_only, descriptors_offset_,
+                                          descriptor_rows_ * descriptor_step_));
+    } catch (const bi::interprocess_exception & /* error */) {
+      // leave descriptors empty
+      return;
+    }
+    // the mapping is read-only. never modify the descriptors.
+    descriptors_ = cv::Mat(descriptor_rows_, descriptor_cols_, descriptor_type_,
+                           region_->get_address(), descriptor_step_);
+  }
+
+  void decodeDescriptors() const {
+    descriptors_node_ >> descriptors_;
+    // the parsed file is no longer needed
+    descriptors_node_ = cv::FileNode();
+    fs_.release();
+  }
+
+protected:
+  const std::string path_;
+  bool binary_;
+
+  std::vector< cv::KeyPoint > keypoints_;
+  int norm_type_;
+  int descriptor_rows_;
+  int descriptor_cols_;
+  int descriptor_type_;
+  boost::uint64_t params_hash_;
+  boost::uint64_t contour_hash_;
+
+  // for binary files
+  boost::uint64_t descriptors_offset_;
+  boost::uint64_t descriptor_step_;
+  mutable boost::shared_ptr< boost::interprocess::mapped_region > region_;
+
+  // for FileStorage files
+  mutable cv::FileStorage fs_;
+  mutable cv::FileNode descriptors_node_;
+
+  mutable boost::mutex mutex_;
+  mutable bool descriptors_loaded_;
+  mutable cv::Mat descriptors_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef AFFINE_INVARIANT_FEATURES_MATCHER_INDEX_FILE
+#define AFFINE_INVARIANT_FEATURES_MATCHER_INDEX_FILE
+
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// Files of trained matchers (e.g. HNSWMatcher, MIHMatcher, PQMatcher or SketchMatcher)
+// tagged with the hash of parameters (FeatureParameters::hash()) which generated the indexed
+// descriptors and the number of the descriptors. An index built for other parameters or another
+// reference is refused by comparing the tags before the matcher reads and rebuilds its index,
+// so that ResultMatcher never uses a stale index as is.
+//
+
+// cv::FileStorage has no 64-bit integers. the hash is written as a hex string.
+static inline std::string formatParamsHash(const boost::uint64_t params_hash) {
+  std::ostringstream oss;
+  oss << std::hex << std::setw(16) << std::setfill('0') << params_hash;
+  return oss.str();
+}
+
+// ndescriptors is the number of rows of the indexed descriptors (e.g. of the reference)
+static inline void writeMatcherIndexFile(const std::string &path,
+                                         const cv::DescriptorMatcher &matcher,
+                                         const boost::uint64_t params_hash,
+                                         const int ndescriptors) {
+  cv::FileStorage fs(path, cv::FileStorage::WRITE);
+  CV_Assert(fs.isOpened());
+  fs << "paramsHash" << formatParamsHash(params_hash);
+  fs << "nDescriptors" << ndescriptors;
+  fs << matcher.getDefaultName() << "{";
+  matcher.write(fs);
+  fs << "}";
+}
+
+// return false and leave the matcher untouched if the file cannot be opened
+// or is indexed for other parameters, another number of descriptors or another matcher
+static inline bool readMatcherIndexFile(const std::string &path, cv::DescriptorMatcher &matcher,
+                                        const boost::uint64_t params_hash,
+                                        const int ndescriptors) {
+  const cv::FileStorage fs(path, cv::FileStorage::READ);
+  if (!fs.isOpened()) {
+    return false;
+  }
+
+  // tags are compared before parsing the index, which is much larger
+  std::string file_hash;
+  fs["paramsHash"] >> file_hash;
+  if (file_hash != formatParamsHash(params_hash)) {
+    return false;
+  }
+
+  int file_ndescriptors;
+  cv::read(fs["nDescriptors"], file_ndescriptors, -1);
+  if (file_ndescriptors != ndescriptors) {
+    return false;
+  }
+
+  const cv::FileNode node(fs[matcher.getDefaultName()]);
+  if (node.empty()) {
+    return false;
+  }
+  matcher.read(node);
+  return true;
+}
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
@@ -0,0 +1,344 @@
+#ifndef AFFINE_INVARIANT_FEATURES_MIH_MATCHER
+#define AFFINE_INVARIANT_FEATURES_MIH_MATCHER
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <affine_invariant_features/visited_list.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// An exact matcher by multi-index hashing (MIH) for NORM_HAMMING descriptors.
+// Each descriptor is split into m substrings and each substring is indexed in its own table.
+// A descriptor within distance r of a query has a substring within distance r / m of
+// the corresponding query substring, so searching tables with increasing substring radius
+// finds exact nearest neighbors without scanning the whole database.
+//
+
+class MIHMatcher : public cv::DescriptorMatcher {
+protected:
+  // a pair of a hamming distance and a descriptor id
+  typedef std::pair< int, int > Candidate;
+  // a pair of a substring and a descriptor id
+  typedef std::pair< unsigned int, int > Entry;
+
+public:
+  // the number of substrings is chosen from the database size if nsubstrings <= 0
+  MIHMatcher(const int nsubstrings = 0)
+      : nsubstrings_(nsubstrings), bytes_(0), offsets_(1, 0), bounds_(1, 0) {}
+
+  virtual ~MIHMatcher() {}
+
+  static cv::Ptr< MIHMatcher > create(const int nsubstrings = 0) {
+    return new MIHMatcher(nsubstrings);
+  }
+
+  //
+  // overloaded functions from cv::DescriptorMatcher or its base class
+  //
+
+  virtual void clear() {
+    cv::DescriptorMatcher::clear();
+    bytes_ = 0;
+    rows_.clear();
+    offsets_.assign(1, 0);
+    bounds_.assign(1, 0);
+    tables_.clear();
+  }
+
+  virtual bool isMaskSupported() const { return false; }
+
+  virtual void train() {
+    // rebuild tables if descriptors have been added after the last training
+    if (trainDescCollection.size() + 1 <= offsets_.size()) {
+      return;
+    }
+    appendRows();
+    buildTables();
+  }
+
+  // tables are not stored because rebuilding them from descriptors is fast
+  virtual void read(const cv::FileNode &fn) {
+    clear();
+    fn["nsubstrings"] >> nsubstrings_;
+    const cv::FileNode descriptors_node(fn["descriptors"]);
+    trainDescCollection.resize(descriptors_node.isSeq() ? descriptors_node.size() : 0);
+    for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+      descriptors_node[i] >> trainDescCollection[i];
+    }
+    appendRows();
+    buildTables();
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "nsubstrings" << nsubstrings_;
+    fs << "descriptors";
+    fs << "[";
+    for (std::size_t i = 0; i + 1 < offsets_.size(); ++i) {
+      fs << trainDescCollection[i];
+    }
+    fs << "]";
+  }
+
+  virtual cv::Ptr< cv::DescriptorMatcher > clone(const bool emptyTrainData = false) const {
+    const cv::Ptr< MIHMatcher > matcher(new MIHMatcher(nsubstrings_));
+    if (!emptyTrainData) {
+      matcher->trainDescCollection = trainDescCollection;
+      matcher->bytes_ = bytes_;
+      matcher->rows_ = rows_;
+      matcher->offsets_ = offsets_;
+      matcher->bounds_ = bounds_;
+      matcher->tables_ = tables_;
+    }
+    return matcher;
+  }
+
+  virtual cv::String getDefaultName() const { return "MIHMatcher"; }
+
+protected:
+  virtual void knnMatchImpl(cv::InputArray queryDescriptors,
+                            std::vector< std::vector< cv::DMatch > > &matches, int k,
+                            cv::InputArrayOfArrays /* masks */, bool /* compactResult */) {
+    const cv::Mat query(queryDescriptors.getMat());
+    CV_Assert(query.type() == CV_8UC1 && query.cols == bytes_);
+
+    matches.clear();
+    matches.resize(query.rows);
+    VisitedList visited(rows_.size());
+    std::vector< Candidate > candidates;
+    for (int i = 0; i < query.rows; ++i) {
+      search(query.ptr< uchar >(i), k, INT_MAX, visited, candidates);
+      for (std::size_t c = 0; c < candidates.size(); ++c) {
+        matches[i].push_back(toDMatch(i, candidates[c]));
+      }
+    }
+  }
+
+  virtual void radiusMatchImpl(cv::InputArray queryDescriptors,
+                               std::vector< std::vector< cv::DMatch > > &matches,
+                               float maxDistance, cv::InputArrayOfArrays /* masks */,
+                               bool /* compactResult */) {
+    const cv::Mat query(queryDescriptors.getMat());
+    CV_Assert(query.type() == CV_8UC1 && query.cols == bytes_);
+
+    matches.clear();
+    matches.resize(query.rows);
+    VisitedList visited(rows_.size());
+    std::vector< Candidate > candidates;
+    for (int i = 0; i < query.rows; ++i) {
+      search(query.ptr< uchar >(i), 0, cvFloor(maxDistance), visited, candidates);
+      for (std::size_t c = 0; c < candidates.size(); ++c) {
+        matches[i].push_back(toDMatch(i, candidates[c]));
+      }
+    }
+  }
+
+  // register row pointers of descriptors added after the last training
+  void appendRows() {
+    for (std::size_t i = offsets_.size() - 1; i < trainDescCollection.size(); ++i) {
+      const cv::Mat &descriptors(trainDescCollection[i]);
+      CV_Assert(descriptors.type() == CV_8UC1);
+      CV_Assert(rows_.empty() || descriptors.cols == bytes_);
+      bytes_ = descriptors.cols;
+      for (int r = 0; r < descriptors.rows; ++r) {
+        rows_.push_back(descriptors.ptr< uchar >(r));
+      }
+      offsets_.push_back(rows_.size());
+    }
+  }
+
+  void buildTables() {
+    // split descriptors so that each substring has about log2(N) bits,
+    // which makes each table bucket hold about one descriptor.
+    // a substring must fit in an unsigned int.
+    const int nbits(bytes_ * 8);
+    int m(nsubstrings_);
+    if (m <= 0) {
+      const double log2n(std::log(std::max< double >(rows_.size(), 2.)) / std::log(2.));
+      m = cvRound(nbits / log2n);
+    }
+    m = std::min(std::max(m, (nbits + 31) / 32), nbits);
+    m = std::max(m, 1);
+
+    bounds_.resize(m + 1);
+    for (int i = 0; i <= m; ++i) {
+      bounds_[i] = (nbits * i) / m;
+    }
+
+    // each table is a sorted array of substrings and ids
+    tables_.assign(m, std::vector< Entry >(rows_.size()));
+    for (int i = 0; i < m; ++i) {
+      for (std::size_t id = 0; id < rows_.size(); ++id) {
+        tables_[i][id] = Entry(substring(rows_[id], i), id);
+      }
+      std::sort(tables_[i].begin(), tables_[i].end());
+    }
+  }
+
+  unsigned int substring(const uchar *descriptor, const int i) const {
+    unsigned int value(0);
+    for (int bit = bounds_[i]; bit < bounds_[i + 1]; ++bit) {
+      value |= ((descriptor[bit >> 3] >> (bit & 7)) & 1u) << (bit - bounds_[i]);
+    }
+    return value;
+  }
+
+  // find the k nearest descriptors within max_distance sorted by their distances.
+  // k == 0 means all descriptors within max_distance.
+  void search(const uchar *query, const std::size_t k, const int max_distance,
+              VisitedList &visited, std::vector< Candidate > &candidates) const {
+    candidates.clear();
+    visited.reset();
+    if (rows_.empty()) {
+      return;
+    }
+
+    const int m(tables_.size());
+    std::vector< unsigned int > keys(m);
+    int max_bits(0);
+    for (int i = 0; i < m; ++i) {
+      keys[i] = substring(query, i);
+      max_bits = std::max(max_bits, bounds_[i + 1] - bounds_[i]);
+    }
+
+    for (int radius = 0; radius <= max_bits; ++radius) {
+      // descriptors not found yet have substring distances >= radius in all tables,
+      // so their distances are >= m * radius
+      const int bound(m * radius);
+      if (bound > max_distance) {
+        break;
+      }
+      if (k > 0 && candidates.size() >= k && candidates.front().first <= bound) {
+        break;
+      }
+
+      // scan all remaining descriptors if enumerating substrings costs more
+      double nprobes(0.);
+      for (int i = 0; i < m; ++i) {
+        nprobes += combinations(bounds_[i + 1] - bounds_[i], radius);
+      }
+      if (nprobes > rows_.size()) {
+        for (std::size_t id = 0; id < rows_.size(); ++id) {
+          if (!visited.visit(id)) {
+            consider(query, id, k, max_distance, candidates);
+          }
+        }
+        break;
+      }
+
+      // look up all substrings at the radius from the query substring in each table
+      for (int i = 0; i < m; ++i) {
+        const int nbits(bounds_[i + 1] - bounds_[i]);
+        if (radius > nbits) {
+          continue;
+        }
+        std::vector< int > flips(radius);
+        for (int f = 0; f < radius; ++f) {
+          flips[f] = f;
+        }
+        while (true) {
+          unsigned int key(keys[i]);
+          for (int f = 0; f < radius; ++f) {
+            key ^= 1u << flips[f];
+          }
+          lookup(i, key, query, k, max_distance, visited, candidates);
+
+          // next combination of bits to be flipped
+          int f(radius - 1);
+          while (f >= 0 && flips[f] == nbits - radius + f) {
+            --f;
+          }
+          if (f < 0) {
+            break;
+          }
+          ++flips[f];
+          for (int g = f + 1; g < radius; ++g) {
+            flips[g] = flips[g - 1] + 1;
+          }
+        }
+      }
+    }
+
+    if (k > 0) {
+      std::sort_heap(candidates.begin(), candidates.end());
+    } else {
+      std::sort(candidates.begin(), candidates.end());
+    }
+  }
+
+  void lookup(const int i, const unsigned int key, const uchar *query, const std::size_t k,
+              const int max_distance, VisitedList &visited,
+              std::vector< Candidate > &candidates) const {
+    const std::vector< Entry > &table(tables_[i]);
+    const std::vector< Entry >::const_iterator begin(
+        std::lower_bound(table.begin(), table.end(), Entry(key, INT_MIN)));
+    const std::vector< Entry >::const_iterator end(
+        std::upper_bound(begin, table.end(), Entry(key, INT_MAX)));
+    for (std::vector< Entry >::const_iterator entry = begin; entry != end; ++entry) {
+      if (!visited.visit(entry->second)) {
+        consider(query, entry->second, k, max_distance, candidates);
+      }
+    }
+  }
+
+  // keep the given descriptor if it is within max_distance and one of the k nearest.
+  // candidates is a max-heap if k > 0.
+  void consider(const uchar *query, const int id, const std::size_t k, const int max_distance,
+                std::vector< Candidate > &candidates) const {
+    const Candidate candidate(cv::hal::normHamming(query, rows_[id], bytes_), id);
+    if (candidate.first > max_distance) {
+      return;
+    }
+    if (k == 0) {
+      candidates.push_back(candidate);
+    } else if (candidates.size() < k) {
+      candidates.push_back(candidate);
+      std::push_heap(candidates.begin(), candidates.end());
+    } else if (candidate < candidates.front()) {
+      std::pop_heap(candidates.begin(), candidates.end());
+      candidates.back() = candidate;
+      std::push_heap(candidates.begin(), candidates.end());
+    }
+  }
+
+  static double combinations(const int n, const int r) {
+    if (r < 0 || r > n) {
+      return 0.;
+    }
+    double value(1.);
+    for (int i = 1; i <= r; ++i) {
+      value = value * (n - r + i) / i;
+    }
+    return value;
+  }
+
+  cv::DMatch toDMatch(const int query_idx, const Candidate &candidate) const {
+    const int img(std::upper_bound(offsets_.begin(), offsets_.end(), candidate.second) -
+                  offsets_.begin() - 1);
+    return cv::DMatch(query_idx, candidate.second - offsets_[img], img, candidate.first);
+  }
+
+protected:
+  int nsubstrings_;
+
+  int bytes_;
+  // row pointers of all descriptors, which are owned by trainDescCollection
+  std::vector< const uchar * > rows_;
+  // the first id of each image and the total number of ids
+  std::vector< int > offsets_;
+  // the first bit of each substring and the total number of bits
+  std::vector< int > bounds_;
+  // sorted substrings of all descriptors for each substring position
+  std::vector< std::vector< Entry > > tables_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
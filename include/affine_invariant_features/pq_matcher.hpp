@@ -0,0 +1,469 @@
+#ifndef AFFINE_INVARIANT_FEATURES_PQ_MATCHER
+#define AFFINE_INVARIANT_FEATURES_PQ_MATCHER
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <affine_invariant_features/cv_serializable.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A product quantizer that compresses a float descriptor to one byte per subspace
+//
+
+struct ProductQuantizer : public CvSerializable {
+public:
+  ProductQuantizer() {}
+
+  virtual ~ProductQuantizer() {}
+
+  // learn a codebook of each subspace by k-means on the given descriptors (CV_32FC1)
+  void train(const cv::Mat &descriptors, const int nsubspaces, const int ncentroids = 256) {
+    CV_Assert(descriptors.type() == CV_32FC1 && descriptors.rows > 0);
+    CV_Assert(nsubspaces > 0 && descriptors.cols % nsubspaces == 0);
+    CV_Assert(ncentroids > 0 && ncentroids <= 256);
+
+    const int subdim(descriptors.cols / nsubspaces);
+    const int k(std::min(ncentroids, descriptors.rows));
+    centroids.resize(nsubspaces);
+    for (int s = 0; s < nsubspaces; ++s) {
+      // cv::kmeans() requires a continuous array
+      const cv::Mat subspace(descriptors.colRange(s * subdim, (s + 1) * subdim).clone());
+      cv::Mat labels;
+      cv::kmeans(subspace, k, labels,
+                 cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 25, 1e-4), 1,
+                 cv::KMEANS_PP_CENTERS, centroids[s]);
+    }
+  }
+
+  bool empty() const { return centroids.empty(); }
+
+  int subspaces() const { return centroids.size(); }
+
+  int dims() const { return centroids.empty() ? 0 : centroids.size() * centroids[0].cols; }
+
+  // replace each subspace of the given descriptors by the index of the nearest centroid
+  void encode(const cv::Mat &descriptors, cv::Mat &codes) const {
+    CV_Assert(descriptors.type() == CV_32FC1 && descriptors.cols == dims());
+
+    codes.create(descriptors.rows, subspaces(), CV_8UC1);
+    for (int s = 0; s < subspaces(); ++s) {
+      const int subdim(centroids[s].cols);
+      cv::Mat dists, indices;
+      cv::batchDistance(descriptors.colRange(s * subdim, (s + 1) * subdim), centroids[s], dists,
+                        CV_32F, indices, cv::NORM_L2SQR, 1);
+      for (int i = 0; i < descriptors.rows; ++i) {
+        codes.at< uchar >(i, s) = static_cast< uchar >(indices.at< int >(i, 0));
+      }
+    }
+  }
+
+  // squared distances from the given query to every centroid of every subspace.
+  // the distance to a code is the sum of table entries selected by the code (asymmetric distance).
+  void computeDistanceTable(const float *query, cv::Mat &table) const {
+    CV_Assert(!empty());
+
+    table.create(subspaces(), centroids[0].rows, CV_32FC1);
+    for (int s = 0; s < subspaces(); ++s) {
+      const int subdim(centroids[s].cols);
+      const float *const subquery(query + s * subdim);
+      float *const row(table.ptr< float >(s));
+      for (int k = 0; k < centroids[s].rows; ++k) {
+        const float *const centroid(centroids[s].ptr< float >(k));
+        float dist(0.f);
+        for (int d = 0; d < subdim; ++d) {
+          const float diff(subquery[d] - centroid[d]);
+          dist += diff * diff;
+        }
+        row[k] = dist;
+      }
+    }
+  }
+
+  static float computeDistance(const cv::Mat &table, const uchar *code) {
+    float dist(0.f);
+    for (int s = 0; s < table.rows; ++s) {
+      dist += table.ptr< float >(s)[code[s]];
+    }
+    return dist;
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    const cv::FileNode centroids_node(fn["centroids"]);
+    const std::size_t nsubspaces(centroids_node.isSeq() ? centroids_node.size() : 0);
+    centroids.resize(nsubspaces);
+    for (std::size_t s = 0; s < nsubspaces; ++s) {
+      centroids_node[s] >> centroids[s];
+    }
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "centroids";
+    fs << "[";
+    for (std::vector< cv::Mat >::const_iterator c = centroids.begin(); c != centroids.end(); ++c) {
+      fs << *c;
+    }
+    fs << "]";
+  }
+
+  virtual std::string getDefaultName() const { return "ProductQuantizer"; }
+
+public:
+  // centroids of each subspace (ncentroids x subdim, CV_32FC1)
+  std::vector< cv::Mat > centroids;
+};
+
+//
+// An inverted-file matcher on product-quantized residuals (IVF-PQ) for NORM_L2 descriptors.
+// The index takes nsubspaces bytes of a code and 4 bytes of an id per descriptor
+// (e.g. 20 bytes for a 128-dim descriptor whose float values take 512 bytes).
+// If nreranks > 0, shortlisted candidates are re-ranked by exact distances to the added
+// descriptors, which are shared with the caller, not copied, but are kept referenced
+// so the float values stay on memory (or in a mapped file, see results_file.hpp) as well.
+// If nreranks == 0, the added descriptors are released once encoded and only the index remains.
+//
+
+class PQMatcher : public cv::DescriptorMatcher {
+public:
+  PQMatcher(const int nsubspaces = 16, const int nlists = 64, const int nprobes = 8,
+            const int nreranks = 16)
+      : nsubspaces_(nsubspaces), nlists_(nlists), nprobes_(nprobes), nreranks_(nreranks),
+        offsets_(1, 0) {}
+
+  virtual ~PQMatcher() {}
+
+  static cv::Ptr< PQMatcher > create(const int nsubspaces = 16, const int nlists = 64,
+                                     const int nprobes = 8, const int nreranks = 16) {
+    return new PQMatcher(nsubspaces, nlists, nprobes, nreranks);
+  }
+
+  //
+  // overloaded functions from cv::DescriptorMatcher or its base class
+  //
+
+  virtual void add(cv::InputArrayOfArrays descriptors) {
+    // added descriptors must correspond to encoded images one by one
+    // so that they can be used for re-ranking. this is not the case after read().
+    CV_Assert(trainDescCollection.size() + 1 >= offsets_.size());
+    cv::DescriptorMatcher::add(descriptors);
+  }
+
+  virtual void clear() {
+    cv::DescriptorMatcher::clear();
+    coarse_centroids_.release();
+    quantizer_.centroids.clear();
+    codes_.release();
+    lists_.clear();
+    offsets_.assign(1, 0);
+  }
+
+  virtual bool empty() const { return offsets_.back() == 0 && cv::DescriptorMatcher::empty(); }
+
+  virtual bool isMaskSupported() const { return false; }
+
+  virtual void train() {
+    // nothing to do if all added descriptors have been encoded
+    if (trainDescCollection.size() + 1 <= offsets_.size()) {
+      return;
+    }
+
+    // learn quantizers on the first training with any descriptors. later additions reuse them.
+    // the index stays untrained and finds no matches until descriptors are added.
+    if (coarse_centroids_.empty() && !trainQuantizers()) {
+      return;
+    }
+
+    for (std::size_t i = offsets_.size() - 1; i < trainDescCollection.size(); ++i) {
+      encode(trainDescCollection[i]);
+      // the descriptors are no longer needed if they are not used for re-ranking
+      if (nreranks_ <= 0) {
+        trainDescCollection[i].release();
+      }
+    }
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    clear();
+    fn["nsubspaces"] >> nsubspaces_;
+    fn["nlists"] >> nlists_;
+    fn["nprobes"] >> nprobes_;
+    fn["nreranks"] >> nreranks_;
+    fn["coarseCentroids"] >> coarse_centroids_;
+    quantizer_.read(fn[quantizer_.getDefaultName()]);
+    fn["codes"] >> codes_;
+    const cv::FileNode lists_node(fn["lists"]);
+    lists_.resize(lists_node.isSeq() ? lists_node.size() : 0);
+    for (std::size_t l = 0; l < lists_.size(); ++l) {
+      lists_node[l] >> lists_[l];
+    }
+    fn["offsets"] >> offsets_;
+    if (offsets_.empty()) {
+      offsets_.assign(1, 0);
+    }
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "nsubspaces" << nsubspaces_;
+    fs << "nlists" << nlists_;
+    fs << "nprobes" << nprobes_;
+    fs << "nreranks" << nreranks_;
+    fs << "coarseCentroids" << coarse_centroids_;
+    quantizer_.save(fs);
+    fs << "codes" << codes_;
+    fs << "lists";
+    fs << "[";
+    for (std::vector< std::vector< int > >::const_iterator l = lists_.begin(); l != lists_.end();
+         ++l) {
+      fs << *l;
+    }
+    fs << "]";
+    fs << "offsets" << offsets_;
+  }
+
+  virtual cv::Ptr< cv::DescriptorMatcher > clone(const bool emptyTrainData = false) const {
+    const cv::Ptr< PQMatcher > matcher(
+        new PQMatcher(nsubspaces_, nlists_, nprobes_, nreranks_));
+    if (!emptyTrainData) {
+      matcher->trainDescCollection = trainDescCollection;
+      matcher->coarse_centroids_ = coarse_centroids_.clone();
+      matcher->quantizer_.centroids.resize(quantizer_.centroids.size());
+      for (std::size_t s = 0; s < quantizer_.centroids.size(); ++s) {
+        matcher->quantizer_.centroids[s] = quantizer_.centroids[s].clone();
+      }
+      matcher->codes_ = codes_.clone();
+      matcher->lists_ = lists_;
+      matcher->offsets_ = offsets_;
+    }
+    return matcher;
+  }
+
+  virtual cv::String getDefaultName() const { return "PQMatcher"; }
+
+protected:
+  virtual void knnMatchImpl(cv::InputArray queryDescriptors,
+                            std::vector< std::vector< cv::DMatch > > &matches, int k,
+                            cv::InputArrayOfArrays /* masks */, bool /* compactResult */) {
+    const cv::Mat query(queryDescriptors.getMat());
+
+    matches.clear();
+    matches.resize(query.rows);
+    if (coarse_centroids_.empty()) {
+      return;
+    }
+    CV_Assert(query.type() == CV_32FC1 && query.cols == coarse_centroids_.cols);
+
+    std::vector< std::pair< float, int > > candidates;
+    for (int i = 0; i < query.rows; ++i) {
+      search(query.ptr< float >(i), k, candidates);
+      for (std::size_t c = 0; c < candidates.size(); ++c) {
+        matches[i].push_back(toDMatch(i, candidates[c]));
+      }
+    }
+  }
+
+  virtual void radiusMatchImpl(cv::InputArray queryDescriptors,
+                               std::vector< std::vector< cv::DMatch > > &matches,
+                               float maxDistance, cv::InputArrayOfArrays /* masks */,
+                               bool /* compactResult */) {
+    const cv::Mat query(queryDescriptors.getMat());
+
+    matches.clear();
+    matches.resize(query.rows);
+    if (coarse_centroids_.empty()) {
+      return;
+    }
+    CV_Assert(query.type() == CV_32FC1 && query.cols == coarse_centroids_.cols);
+
+    std::vector< std::pair< float, int > > candidates;
+    for (int i = 0; i < query.rows; ++i) {
+      // radius search takes all entries in the probed lists
+      search(query.ptr< float >(i), -1, candidates);
+      for (std::size_t c = 0; c < candidates.size() && candidates[c].first <= maxDistance; ++c) {
+        matches[i].push_back(toDMatch(i, candidates[c]));
+      }
+    }
+  }
+
+  // return false if no descriptors have been added
+  bool trainQuantizers() {
+    // sample training rows evenly from all added descriptors to bound the cost of k-means
+    static const int max_samples(256 * 256);
+    int nrows(0);
+    for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+      CV_Assert(trainDescCollection[i].empty() || trainDescCollection[i].type() == CV_32FC1);
+      nrows += trainDescCollection[i].rows;
+    }
+    if (nrows == 0) {
+      return false;
+    }
+    const int step(std::max(nrows / max_samples, 1));
+    cv::Mat samples;
+    for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+      for (int r = 0; r < trainDescCollection[i].rows; r += step) {
+        samples.push_back(trainDescCollection[i].row(r));
+      }
+    }
+
+    // coarse quantizer which partitions descriptors into inverted lists
+    cv::Mat labels;
+    cv::kmeans(samples, std::min(nlists_, samples.rows), labels,
+               cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 25, 1e-4), 1,
+               cv::KMEANS_PP_CENTERS, coarse_centroids_);
+
+    // product quantizer on residuals to the coarse centroids
+    for (int r = 0; r < samples.rows; ++r) {
+      cv::Mat sample(samples.row(r));
+      sample -= coarse_centroids_.row(labels.at< int >(r, 0));
+    }
+    quantizer_.train(samples, nsubspaces_);
+
+    lists_.assign(coarse_centroids_.rows, std::vector< int >());
+    return true;
+  }
+
+  void encode(const cv::Mat &descriptors) {
+    // an image without descriptors takes no ids
+    if (descriptors.empty()) {
+      offsets_.push_back(offsets_.back());
+      return;
+    }
+    CV_Assert(descriptors.type() == CV_32FC1 && descriptors.cols == coarse_centroids_.cols);
+
+    // assign each descriptor to the nearest list
+    cv::Mat dists, lists;
+    cv::batchDistance(descriptors, coarse_centroids_, dists, CV_32F, lists, cv::NORM_L2SQR, 1);
+
+    // encode residuals to the assigned lists
+    cv::Mat residuals(descriptors.clone());
+    for (int r = 0; r < residuals.rows; ++r) {
+      cv::Mat residual(residuals.row(r));
+      residual -= coarse_centroids_.row(lists.at< int >(r, 0));
+    }
+    cv::Mat codes;
+    quantizer_.encode(residuals, codes);
+
+    // append codes and register them to the lists
+    const int offset(offsets_.back());
+    codes_.push_back(codes);
+    for (int r = 0; r < descriptors.rows; ++r) {
+      lists_[lists.at< int >(r, 0)].push_back(offset + r);
+    }
+    offsets_.push_back(offset + descriptors.rows);
+  }
+
+  // find candidates ordered by their distances. nwanted < 0 means all entries in the probed lists.
+  void search(const float *query, const int nwanted,
+              std::vector< std::pair< float, int > > &candidates) const {
+    candidates.clear();
+    if (coarse_centroids_.empty()) {
+      return;
+    }
+
+    // find the nearest lists
+    const int dim(coarse_centroids_.cols);
+    std::vector< std::pair< float, int > > list_dists(coarse_centroids_.rows);
+    for (int l = 0; l < coarse_centroids_.rows; ++l) {
+      list_dists[l] =
+          std::make_pair(squaredDistance(query, coarse_centroids_.ptr< float >(l), dim), l);
+    }
+    const int nprobes(std::max(std::min< int >(nprobes_, list_dists.size()), 1));
+    std::partial_sort(list_dists.begin(), list_dists.begin() + nprobes, list_dists.end());
+
+    // scan the lists by asymmetric distances, keeping best candidates in a max-heap
+    const bool rerank(nreranks_ > 0 && !trainDescCollection.empty());
+    const std::size_t ncandidates(nwanted < 0 ? 0 : std::max(nwanted, rerank ? nreranks_ : 0));
+    std::vector< float > residual(dim);
+    cv::Mat table;
+    for (int p = 0; p < nprobes; ++p) {
+      const int l(list_dists[p].second);
+      if (lists_[l].empty()) {
+        continue;
+      }
+      const float *const centroid(coarse_centroids_.ptr< float >(l));
+      for (int d = 0; d < dim; ++d) {
+        residual[d] = query[d] - centroid[d];
+      }
+      quantizer_.computeDistanceTable(&residual[0], table);
+      for (std::vector< int >::const_iterator id = lists_[l].begin(); id != lists_[l].end();
+           ++id) {
+        const std::pair< float, int > candidate(
+            ProductQuantizer::computeDistance(table, codes_.ptr< uchar >(*id)), *id);
+        if (ncandidates == 0 || candidates.size() < ncandidates) {
+          candidates.push_back(candidate);
+          if (ncandidates > 0) {
+            std::push_heap(candidates.begin(), candidates.end());
+          }
+        } else if (candidate < candidates.front()) {
+          std::pop_heap(candidates.begin(), candidates.end());
+          candidates.back() = candidate;
+          std::push_heap(candidates.begin(), candidates.end());
+        }
+      }
+    }
+
+    // replace approximate distances by exact ones of the added descriptors
+    if (rerank) {
+      for (std::vector< std::pair< float, int > >::iterator c = candidates.begin();
+           c != candidates.end(); ++c) {
+        const int img(findImage(c->second));
+        c->first = squaredDistance(
+            query, trainDescCollection[img].ptr< float >(c->second - offsets_[img]), dim);
+      }
+    }
+
+    // finalize candidates
+    std::sort(candidates.begin(), candidates.end());
+    if (nwanted >= 0 && candidates.size() > static_cast< std::size_t >(nwanted)) {
+      candidates.resize(nwanted);
+    }
+    for (std::vector< std::pair< float, int > >::iterator c = candidates.begin();
+         c != candidates.end(); ++c) {
+      c->first = std::sqrt(c->first);
+    }
+  }
+
+  int findImage(const int id) const {
+    return std::upper_bound(offsets_.begin(), offsets_.end(), id) - offsets_.begin() - 1;
+  }
+
+  cv::DMatch toDMatch(const int query_idx, const std::pair< float, int > &candidate) const {
+    const int img(findImage(candidate.second));
+    return cv::DMatch(query_idx, candidate.second - offsets_[img], img, candidate.first);
+  }
+
+  static float squaredDistance(const float *a, const float *b, const int n) {
+    float dist(0.f);
+    for (int i = 0; i < n; ++i) {
+      const float diff(a[i] - b[i]);
+      dist += diff * diff;
+    }
+    return dist;
+  }
+
+protected:
+  int nsubspaces_;
+  int nlists_;
+  int nprobes_;
+  int nreranks_;
+
+  // coarse centroids (nlists x dims, CV_32FC1)
+  cv::Mat coarse_centroids_;
+  ProductQuantizer quantizer_;
+  // codes of all encoded descriptors (ndescriptors x nsubspaces, CV_8UC1)
+  cv::Mat codes_;
+  // ids of encoded descriptors in each list
+  std::vector< std::vector< int > > lists_;
+  // the first id of each encoded image and the total number of ids
+  std::vector< int > offsets_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
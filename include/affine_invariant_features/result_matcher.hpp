@@ -1,17 +1,27 @@
 #ifndef AFFINE_INVARIANT_FEATURES_RESULT_MATCHER
 #define AFFINE_INVARIANT_FEATURES_RESULT_MATCHER
 
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
+#include <utility>
 #include <vector>
 
+#include <affine_invariant_features/geometric_verifier.hpp>
+#include <affine_invariant_features/in_place_flann_matcher.hpp>
 #include <affine_invariant_features/parallel_tasks.hpp>
 #include <affine_invariant_features/results.hpp>
-#include <ros/console.h>
 
 #include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/ref.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
 
-#include <opencv2/calib3d.hpp>
 #include <opencv2/core.hpp>
 #include <opencv2/features2d.hpp>
 #include <opencv2/flann.hpp>
@@ -20,39 +30,224 @@ namespace affine_invariant_features {
 
 class ResultMatcher {
 public:
-  ResultMatcher(const cv::Ptr< const Results > &reference) : reference_(reference) {
+  // a descriptor matcher can be given to replace the default index for the norm type.
+  // the default index is built on the descriptors of the reference without copying them.
+  // the given matcher is used as is if it already has an index (e.g. read from a file).
+  // read such a matcher by readMatcherIndexFile() with the parameters hash and the number of
+  // descriptors of the reference so that an index of other descriptors is refused.
+  // if train is false, the index is not built until train() or trainInBackground() is called
+  // and match() searches the reference by brute force meanwhile.
+  // the descriptors of the reference are kept for the brute force search and track()
+  // whatever the index is. to save memory by a compact index (e.g. PQMatcher without
+  // re-ranking), give a reference whose descriptors are mapped from a file (see results_file.hpp).
+  ResultMatcher(
+      const cv::Ptr< const Results > &reference,
+      const cv::Ptr< cv::DescriptorMatcher > &matcher = cv::Ptr< cv::DescriptorMatcher >(),
+      const bool train = true)
+      : reference_(reference), matcher_(matcher), state_(Untrained), min_parallel_rows_(1000),
+        tracking_radius_(20.), grid_built_(false) {
     CV_Assert(reference_);
 
-    switch (reference_->normType) {
-    case cv::NORM_L2:
-      matcher_ = new cv::FlannBasedMatcher(new cv::flann::KDTreeIndexParams(4));
-      break;
-    case cv::NORM_HAMMING:
-      matcher_ = new cv::FlannBasedMatcher(new cv::flann::LshIndexParams(6, 12, 1));
-      break;
+    if (!matcher_) {
+      switch (reference_->normType) {
+      case cv::NORM_L2:
+        matcher_ = InPlaceFlannMatcher::create(new cv::flann::KDTreeIndexParams(4));
+        break;
+      case cv::NORM_HAMMING:
+        matcher_ = InPlaceFlannMatcher::create(new cv::flann::LshIndexParams(6, 12, 1));
+        break;
+      }
     }
 
     CV_Assert(matcher_);
 
-    matcher_->add(reference_->descriptors);
-    matcher_->train();
+    if (matcher_->empty()) {
+      matcher_->add(reference_->descriptors);
+    }
+    if (train) {
+      this->train();
+    } else {
+      brute_force_ = new cv::BFMatcher(reference_->normType);
+      brute_force_->add(reference_->descriptors);
+    }
   }
 
   virtual ~ResultMatcher() {}
 
+  // build the index. this blocks until the index is built even if another thread is building.
+  // an error from the index is rethrown, and train() can be called again to retry.
+  void train() {
+    {
+      boost::unique_lock< boost::mutex > lock(state_mutex_);
+      while (state_ == Training) {
+        state_condition_.wait(lock);
+      }
+      if (state_ == Trained) {
+        return;
+      }
+      state_ = Training;
+    }
+
+    try {
+      matcher_->train();
+    } catch (...) {
+      boost::lock_guard< boost::mutex > lock(state_mutex_);
+      state_ = Failed;
+      state_condition_.notify_all();
+      throw;
+    }
+
+    boost::lock_guard< boost::mutex > lock(state_mutex_);
+    state_ = Trained;
+    state_condition_.notify_all();
+  }
+
+  bool isTrained() const {
+    boost::lock_guard< boost::mutex > lock(state_mutex_);
+    return state_ == Trained;
+  }
+
+  // wait for the index built by train() or trainInBackground() on another thread.
+  // return false if the build has failed.
+  bool waitUntilTrained() const {
+    boost::unique_lock< boost::mutex > lock(state_mutex_);
+    while (state_ != Trained && state_ != Failed) {
+      state_condition_.wait(lock);
+    }
+    return state_ == Trained;
+  }
+
+  // build indices of the matchers in parallel on a background thread and return the thread
+  // immediately. matchers are kept alive until their indices are built.
+  // join the thread before exiting the process so that it does not outlive static objects.
+  static boost::shared_ptr< boost::thread >
+  trainInBackground(const std::vector< cv::Ptr< ResultMatcher > > &matchers,
+                    const double nstripes = -1.) {
+    return boost::shared_ptr< boost::thread >(
+        new boost::thread(boost::bind(&ResultMatcher::trainAll, matchers, nstripes)));
+  }
+
   const Results &getReference() const { return *reference_; }
 
-  void match(const Results &source, cv::Matx33f &transform, std::vector< cv::DMatch > &matches,
-             const double min_match_ratio = 0.) const {
-    // number of matches wanted
-    const int n_min_matches(std::ceil(min_match_ratio * reference_->keypoints.size()));
+  const VerificationParameters &getVerificationParameters() const {
+    return verifier_.getParameters();
+  }
+
+  void setVerificationParameters(const VerificationParameters &params) {
+    verifier_.setParameters(params);
+  }
+
+  // source descriptors are searched in parallel stripes of this number of rows at least.
+  // the search is serial if the source has fewer rows or min_rows <= 0.
+  int getMinParallelRows() const { return min_parallel_rows_; }
 
+  void setMinParallelRows(const int min_rows) { min_parallel_rows_ = min_rows; }
+
+  // radius in pixels of the window where track() searches the reference
+  // around the position predicted by the prior transform
+  double getTrackingRadius() const { return tracking_radius_; }
+
+  void setTrackingRadius(const double radius) {
+    CV_Assert(radius > 0.);
+    boost::lock_guard< boost::mutex > lock(grid_mutex_);
+    tracking_radius_ = radius;
+    grid_built_ = false;
+  }
+
+  void match(const Results &source, cv::Matx33f &transform, std::vector< cv::DMatch > &matches,
+             const double min_match_ratio = 0., VerificationReport *report = NULL) const {
     // find the 1st & 2nd matches for each descriptor in the source
     std::vector< std::vector< cv::DMatch > > all_matches;
-    matcher_->knnMatch(source.descriptors, all_matches, 2);
+    knnMatch(source.descriptors, all_matches);
+
+    verify(source, all_matches, transform, matches, min_match_ratio, report);
+  }
+
+  // match features in the source only to reference features near their positions
+  // predicted by the prior transform (e.g. the transform found in the previous video frame).
+  // fall back to the full search by match() if the target is lost.
+  void track(const Results &source, const cv::Matx33f &prior, cv::Matx33f &transform,
+             std::vector< cv::DMatch > &matches, const double min_match_ratio = 0.,
+             VerificationReport *report = NULL) const {
+    // find the 1st & 2nd matches for each descriptor in the source within the windows
+    std::vector< std::vector< cv::DMatch > > all_matches;
+    guidedKnnMatch(source, prior, all_matches);
+
+    verify(source, all_matches, transform, matches, min_match_ratio, report);
+    if (matches.empty()) {
+      match(source, transform, matches, min_match_ratio, report);
+    }
+  }
+
+  // match many sources at once. descriptors of all sources are searched by a single query
+  // so that the reference index is traversed once per batch while it stays in cache.
+  void matchBatch(const std::vector< cv::Ptr< const Results > > &sources,
+                  std::vector< cv::Matx33f > &transforms,
+                  std::vector< std::vector< cv::DMatch > > &matches_array,
+                  const double min_match_ratio = 0.,
+                  std::vector< VerificationReport > *reports = NULL) const {
+    // initiate output
+    const int nsources(sources.size());
+    transforms.resize(nsources, cv::Matx33f::eye());
+    matches_array.resize(nsources);
+    if (reports) {
+      reports->resize(nsources);
+    }
+
+    // concatenate descriptors of all sources
+    std::vector< int > offsets(1, 0);
+    std::vector< cv::Mat > descriptors_array;
+    for (int i = 0; i < nsources; ++i) {
+      CV_Assert(sources[i]);
+      if (!sources[i]->descriptors.empty()) {
+        descriptors_array.push_back(sources[i]->descriptors);
+      }
+      offsets.push_back(offsets.back() + sources[i]->descriptors.rows);
+    }
+    cv::Mat descriptors;
+    if (descriptors_array.size() == 1) {
+      descriptors = descriptors_array[0];
+    } else if (descriptors_array.size() > 1) {
+      cv::vconcat(descriptors_array, descriptors);
+    }
+
+    // find the 1st & 2nd matches for all descriptors
+    std::vector< std::vector< cv::DMatch > > all_matches;
+    if (!descriptors.empty()) {
+      knnMatch(descriptors, all_matches);
+    }
+    all_matches.resize(offsets.back());
+
+    // split matches into each source and verify them
+    for (int i = 0; i < nsources; ++i) {
+      std::vector< std::vector< cv::DMatch > > source_matches(all_matches.begin() + offsets[i],
+                                                              all_matches.begin() + offsets[i + 1]);
+      for (std::size_t j = 0; j < source_matches.size(); ++j) {
+        for (std::vector< cv::DMatch >::iterator m = source_matches[j].begin();
+             m != source_matches[j].end(); ++m) {
+          m->queryIdx -= offsets[i];
+        }
+      }
+      verify(*sources[i], source_matches, transforms[i], matches_array[i], min_match_ratio,
+             reports ? &(*reports)[i] : NULL);
+    }
+  }
 
-    // filter unique matches whose 1st is enough better than 2nd
+private:
+  void verify(const Results &source, const std::vector< std::vector< cv::DMatch > > &all_matches,
+              cv::Matx33f &transform, std::vector< cv::DMatch > &matches,
+              const double min_match_ratio, VerificationReport *report) const {
+    if (report) {
+      *report = VerificationReport();
+    }
+
+    // number of matches wanted
+    const int n_min_matches(std::ceil(min_match_ratio * reference_->keypoints.size()));
+
+    // filter unique matches whose 1st is enough better than 2nd.
+    // also remember the ratio of distances as the quality of each unique match.
     std::vector< cv::DMatch > unique_matches;
+    std::vector< std::pair< float, int > > order;
     for (std::vector< std::vector< cv::DMatch > >::const_iterator m = all_matches.begin();
          m != all_matches.end(); ++m) {
       if (m->size() < 2) {
@@ -61,40 +256,61 @@ public:
       if ((*m)[0].distance > 0.75 * (*m)[1].distance) {
         continue;
       }
+      order.push_back(std::make_pair(
+          (*m)[1].distance > 0. ? (*m)[0].distance / (*m)[1].distance : 0.f,
+          static_cast< int >(unique_matches.size())));
       unique_matches.push_back((*m)[0]);
     }
     if (unique_matches.size() < std::max(n_min_matches, 4)) {
       // abort if the number of unique matches is less than required.
-      // 4 is the minimum requirement for cv::findHomography().
+      // 4 is the minimum requirement for homography estimation.
       matches.clear();
       return;
     }
 
-    // further filter matches compatible to a registration
+    // collapse duplicated matches into their most distinctive one
+    std::stable_sort(order.begin(), order.end());
+    std::vector< int > representatives;
+    collapseDuplicates(source, unique_matches, order, representatives);
+
+    // further filter matches compatible to a registration.
+    // the verifier tries the most distinctive matches first.
     std::vector< unsigned char > mask;
     {
-      std::vector< cv::Point2f > source_points;
-      std::vector< cv::Point2f > reference_points;
-      for (std::vector< cv::DMatch >::const_iterator m = unique_matches.begin();
-           m != unique_matches.end(); ++m) {
-        source_points.push_back(source.keypoints[m->queryIdx].pt);
-        reference_points.push_back(reference_->keypoints[m->trainIdx].pt);
-      }
-      try {
-        transform = cv::findHomography(source_points, reference_points, cv::RANSAC, 5., mask);
-      } catch (const cv::Exception & /* error */) {
-        // abort if cv::findHomography() is failed. this can happen when no good transform is found.
-        ROS_INFO("An exception from cv::findHomography() was properly handled. "
-                 "An error message may be printed just before this message but it is still ok.");
+      std::vector< cv::KeyPoint > source_keypoints;
+      std::vector< cv::KeyPoint > reference_keypoints;
+      for (std::vector< std::pair< float, int > >::const_iterator o = order.begin();
+           o != order.end(); ++o) {
+        if (representatives[o->second] != o->second) {
+          continue;
+        }
+        const cv::DMatch &m(unique_matches[o->second]);
+        source_keypoints.push_back(source.keypoints[m.queryIdx]);
+        reference_keypoints.push_back(reference_->keypoints[m.trainIdx]);
+      }
+      const bool found(
+          verifier_.verify(source_keypoints, reference_keypoints, transform, mask, report));
+      if (report) {
+        report->duplicates = unique_matches.size() - source_keypoints.size();
+      }
+      if (!found) {
+        // abort if no good transform is found
         matches.clear();
         return;
       }
     }
 
-    // pack the final matches
+    // pack the final matches in the original order.
+    // duplicates follow the verification of their representatives.
+    std::vector< unsigned char > inliers(unique_matches.size(), 0);
+    for (std::size_t i = 0, j = 0; i < order.size(); ++i) {
+      if (representatives[order[i].second] == order[i].second) {
+        inliers[order[i].second] = mask[j++];
+      }
+    }
     matches.clear();
     for (std::size_t i = 0; i < unique_matches.size(); ++i) {
-      if (mask[i] == 0) {
+      if (inliers[representatives[i]] == 0) {
         continue;
       }
       matches.push_back(unique_matches[i]);
@@ -106,25 +322,31 @@ public:
     }
   }
 
+public:
   static void parallelMatch(const std::vector< cv::Ptr< const ResultMatcher > > &matchers,
                             const Results &source, std::vector< cv::Matx33f > &transforms,
                             std::vector< std::vector< cv::DMatch > > &matches_array,
                             const std::vector< double > &min_match_ratios = std::vector< double >(),
-                            const double nstripes = -1.) {
+                            const double nstripes = -1.,
+                            std::vector< VerificationReport > *reports = NULL) {
     CV_Assert(min_match_ratios.empty() || matchers.size() == min_match_ratios.size());
 
     // initiate output
     const int ntasks(matchers.size());
     transforms.resize(ntasks, cv::Matx33f::eye());
     matches_array.resize(ntasks);
+    if (reports) {
+      reports->resize(ntasks);
+    }
 
     // populate tasks
     ParallelTasks tasks(ntasks);
     for (int i = 0; i < ntasks; ++i) {
       if (matchers[i]) {
+        VerificationReport *const report(reports ? &(*reports)[i] : NULL);
         tasks[i] = boost::bind(&ResultMatcher::match, matchers[i].get(), boost::ref(source),
                                boost::ref(transforms[i]), boost::ref(matches_array[i]),
-                               min_match_ratios.empty() ? 0. : min_match_ratios[i]);
+                               min_match_ratios.empty() ? 0. : min_match_ratios[i], report);
       }
     }
 
@@ -132,9 +354,294 @@ public:
     cv::parallel_for_(cv::Range(0, ntasks), tasks, nstripes);
   }
 
+private:
+  enum State { Untrained, Training, Trained, Failed };
+
+  static void trainAll(const std::vector< cv::Ptr< ResultMatcher > > &matchers,
+                       const double nstripes) {
+    // populate tasks
+    const int ntasks(matchers.size());
+    ParallelTasks tasks(ntasks);
+    for (int i = 0; i < ntasks; ++i) {
+      if (matchers[i]) {
+        tasks[i] = boost::bind(&ResultMatcher::train, matchers[i].get());
+      }
+    }
+
+    // do paralell training
+    cv::parallel_for_(cv::Range(0, ntasks), tasks, nstripes);
+  }
+
+  // find the 1st & 2nd matches of rows of the source descriptors in parallel stripes,
+  // and merge them in the order of rows
+  void knnMatch(const cv::Mat &descriptors,
+                std::vector< std::vector< cv::DMatch > > &all_matches) const {
+    // search by brute force until the index is built
+    const cv::Ptr< cv::DescriptorMatcher > matcher(isTrained() ? matcher_ : brute_force_);
+
+    // cv::DescriptorMatcher gives no matches rather than a vector per row in these cases
+    if (matcher->empty() || descriptors.empty()) {
+      all_matches.clear();
+      return;
+    }
+
+    const int nstripes(min_parallel_rows_ > 0
+                           ? std::min(cv::getNumThreads(), descriptors.rows / min_parallel_rows_)
+                           : 1);
+    if (nstripes <= 1) {
+      matcher->knnMatch(descriptors, all_matches, 2);
+      return;
+    }
+
+    // populate tasks
+    std::vector< std::vector< std::vector< cv::DMatch > > > stripe_matches(nstripes);
+    std::vector< int > offsets(nstripes + 1);
+    ParallelTasks tasks(nstripes);
+    for (int i = 0; i < nstripes; ++i) {
+      offsets[i] = static_cast< int >(static_cast< int64 >(descriptors.rows) * i / nstripes);
+    }
+    offsets[nstripes] = descriptors.rows;
+    for (int i = 0; i < nstripes; ++i) {
+      tasks[i] = boost::bind(&ResultMatcher::knnMatchRows, matcher.get(), descriptors,
+                             cv::Range(offsets[i], offsets[i + 1]),
+                             boost::ref(stripe_matches[i]));
+    }
+
+    // do paralell matching
+    cv::parallel_for_(cv::Range(0, nstripes), tasks);
+
+    // a stripe whose task failed lacks its matches because ParallelTasks only reports the error.
+    // search it again on this thread so that an error reaches the caller
+    // instead of the matches of later rows being shifted.
+    for (int i = 0; i < nstripes; ++i) {
+      if (stripe_matches[i].size() != offsets[i + 1] - offsets[i]) {
+        knnMatchRows(matcher.get(), descriptors, cv::Range(offsets[i], offsets[i + 1]),
+                     stripe_matches[i]);
+        CV_Assert(stripe_matches[i].size() == offsets[i + 1] - offsets[i]);
+      }
+    }
+
+    // merge matches with query indices offset by the first row of each stripe
+    all_matches.clear();
+    all_matches.reserve(descriptors.rows);
+    for (int i = 0; i < nstripes; ++i) {
+      for (std::size_t j = 0; j < stripe_matches[i].size(); ++j) {
+        all_matches.push_back(stripe_matches[i][j]);
+        for (std::vector< cv::DMatch >::iterator m = all_matches.back().begin();
+             m != all_matches.back().end(); ++m) {
+          m->queryIdx += offsets[i];
+        }
+      }
+    }
+  }
+
+  // find the 1st & 2nd matches of each source descriptor among reference descriptors
+  // whose keypoints are in the window around the position predicted by the prior transform
+  void guidedKnnMatch(const Results &source, const cv::Matx33f &prior,
+                      std::vector< std::vector< cv::DMatch > > &all_matches) const {
+    all_matches.clear();
+    all_matches.resize(source.keypoints.size());
+    buildGridOnce();
+    if (grid_cells_.empty()) {
+      return;
+    }
+
+    const double radius2(tracking_radius_ * tracking_radius_);
+    for (std::size_t i = 0; i < source.keypoints.size(); ++i) {
+      // predict the position in the reference
+      const cv::Point2f &pt(source.keypoints[i].pt);
+      const cv::Vec3f predicted(prior * cv::Vec3f(pt.x, pt.y, 1.f));
+      if (std::abs(predicted[2]) < FLT_EPSILON) {
+        continue;
+      }
+      const cv::Point2f center(predicted[0] / predicted[2], predicted[1] / predicted[2]);
+      // skip a window out of the grid. this also rejects a center which is not finite
+      // or too large to be floored to int, given by a near-degenerate prior.
+      if (!(center.x >= grid_origin_.x - tracking_radius_ &&
+            center.x <= grid_origin_.x + (grid_size_.width + 1) * tracking_radius_ &&
+            center.y >= grid_origin_.y - tracking_radius_ &&
+            center.y <= grid_origin_.y + (grid_size_.height + 1) * tracking_radius_)) {
+        continue;
+      }
+
+      // grid cells overlapping the window
+      const int min_col(std::max(cvFloor((center.x - tracking_radius_ - grid_origin_.x) /
+                                         tracking_radius_),
+                                 0));
+      const int max_col(std::min(cvFloor((center.x + tracking_radius_ - grid_origin_.x) /
+                                         tracking_radius_),
+                                 grid_size_.width - 1));
+      const int min_row(std::max(cvFloor((center.y - tracking_radius_ - grid_origin_.y) /
+                                         tracking_radius_),
+                                 0));
+      const int max_row(std::min(cvFloor((center.y + tracking_radius_ - grid_origin_.y) /
+                                         tracking_radius_),
+                                 grid_size_.height - 1));
+
+      // keep the best 2 reference features in the window
+      const cv::Mat query(source.descriptors.row(i));
+      for (int row = min_row; row <= max_row; ++row) {
+        for (int col = min_col; col <= max_col; ++col) {
+          const std::vector< int > &cell(grid_cells_[row * grid_size_.width + col]);
+          for (std::vector< int >::const_iterator id = cell.begin(); id != cell.end(); ++id) {
+            const cv::Point2f diff(reference_->keypoints[*id].pt - center);
+            if (diff.dot(diff) > radius2) {
+              continue;
+            }
+            const cv::DMatch m(i, *id, 0,
+                               cv::norm(query, reference_->descriptors.row(*id),
+                                        reference_->normType));
+            std::vector< cv::DMatch > &best(all_matches[i]);
+            if (best.size() < 2) {
+              best.push_back(m);
+              if (best.size() == 2 && best[1] < best[0]) {
+                std::swap(best[0], best[1]);
+              }
+            } else if (m < best[1]) {
+              best[1] = m;
+              if (best[1] < best[0]) {
+                std::swap(best[0], best[1]);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // build the grid on the first tracking, not on construction,
+  // so that a matcher which never tracks does not pay for the grid
+  void buildGridOnce() const {
+    boost::lock_guard< boost::mutex > lock(grid_mutex_);
+    if (!grid_built_) {
+      buildGrid();
+      grid_built_ = true;
+    }
+  }
+
+  // bucket reference keypoints into a grid whose cells are as large as the tracking radius
+  void buildGrid() const {
+    grid_cells_.clear();
+    grid_size_ = cv::Size(0, 0);
+    if (reference_->keypoints.empty()) {
+      return;
+    }
+
+    float min_x(FLT_MAX), min_y(FLT_MAX), max_x(-FLT_MAX), max_y(-FLT_MAX);
+    for (std::vector< cv::KeyPoint >::const_iterator k = reference_->keypoints.begin();
+         k != reference_->keypoints.end(); ++k) {
+      min_x = std::min(min_x, k->pt.x);
+      min_y = std::min(min_y, k->pt.y);
+      max_x = std::max(max_x, k->pt.x);
+      max_y = std::max(max_y, k->pt.y);
+    }
+    grid_origin_ = cv::Point2f(min_x, min_y);
+    grid_size_ = cv::Size(cvFloor((max_x - min_x) / tracking_radius_) + 1,
+                          cvFloor((max_y - min_y) / tracking_radius_) + 1);
+    grid_cells_.resize(grid_size_.area());
+    for (std::size_t i = 0; i < reference_->keypoints.size(); ++i) {
+      const cv::Point2f &pt(reference_->keypoints[i].pt);
+      const int col(cvFloor((pt.x - min_x) / tracking_radius_));
+      const int row(cvFloor((pt.y - min_y) / tracking_radius_));
+      grid_cells_[row * grid_size_.width + col].push_back(i);
+    }
+  }
+
+  // the matcher can be shared by stripes because it is already trained
+  // and a search on a trained index does not modify the index
+  static void knnMatchRows(cv::DescriptorMatcher *matcher, const cv::Mat &descriptors,
+                           const cv::Range &rows,
+                           std::vector< std::vector< cv::DMatch > > &matches) {
+    matcher->knnMatch(descriptors.rowRange(rows), matches, 2);
+  }
+
+  struct CellHash {
+    std::size_t operator()(const cv::Vec4i &cell) const {
+      return boost::hash_range(cell.val, cell.val + 4);
+    }
+  };
+
+  // find the representative of each match, which is the most distinctive match
+  // whose source and reference points are both within the tolerance.
+  // matches are given in descending order of their distinctiveness.
+  void collapseDuplicates(const Results &source, const std::vector< cv::DMatch > &matches,
+                          const std::vector< std::pair< float, int > > &order,
+                          std::vector< int > &representatives) const {
+    representatives.resize(matches.size());
+    for (std::size_t i = 0; i < matches.size(); ++i) {
+      representatives[i] = i;
+    }
+    const double tolerance(verifier_.getParameters().duplicateTolerance);
+    if (tolerance <= 0.) {
+      return;
+    }
+
+    // representatives are hashed by their point pairs into cells of 2 * tolerance
+    // so that a duplicate is in the same cell or the adjacent one on its nearer side
+    // in each dimension
+    typedef boost::unordered_map< cv::Vec4i, std::vector< int >, CellHash > Cells;
+    Cells cells;
+    for (std::vector< std::pair< float, int > >::const_iterator o = order.begin();
+         o != order.end(); ++o) {
+      const int i(o->second);
+      const cv::Point2f &source_pt(source.keypoints[matches[i].queryIdx].pt);
+      const cv::Point2f &reference_pt(reference_->keypoints[matches[i].trainIdx].pt);
+      const double coords[4] = {source_pt.x / (2. * tolerance), source_pt.y / (2. * tolerance),
+                                reference_pt.x / (2. * tolerance),
+                                reference_pt.y / (2. * tolerance)};
+      int bins[4][2];
+      for (int d = 0; d < 4; ++d) {
+        bins[d][0] = cvFloor(coords[d]);
+        bins[d][1] = coords[d] - bins[d][0] < 0.5 ? bins[d][0] - 1 : bins[d][0] + 1;
+      }
+
+      for (int v = 0; v < 16 && representatives[i] == i; ++v) {
+        cv::Vec4i cell;
+        for (int d = 0; d < 4; ++d) {
+          cell[d] = bins[d][(v >> d) & 1];
+        }
+        const Cells::const_iterator c(cells.find(cell));
+        if (c == cells.end()) {
+          continue;
+        }
+        for (std::vector< int >::const_iterator j = c->second.begin(); j != c->second.end();
+             ++j) {
+          const cv::Point2f source_diff(source.keypoints[matches[*j].queryIdx].pt - source_pt);
+          const cv::Point2f reference_diff(reference_->keypoints[matches[*j].trainIdx].pt -
+                                           reference_pt);
+          if (std::abs(source_diff.x) <= tolerance && std::abs(source_diff.y) <= tolerance &&
+              std::abs(reference_diff.x) <= tolerance && std::abs(reference_diff.y) <= tolerance) {
+            representatives[i] = *j;
+            break;
+          }
+        }
+      }
+
+      if (representatives[i] == i) {
+        cells[cv::Vec4i(bins[0][0], bins[1][0], bins[2][0], bins[3][0])].push_back(i);
+      }
+    }
+  }
+
 private:
   const cv::Ptr< const Results > reference_;
   cv::Ptr< cv::DescriptorMatcher > matcher_;
+  // used until matcher_ is trained
+  cv::Ptr< cv::DescriptorMatcher > brute_force_;
+  State state_;
+  mutable boost::mutex state_mutex_;
+  mutable boost::condition_variable state_condition_;
+
+  int min_parallel_rows_;
+  GeometricVerifier verifier_;
+
+  // grid index of reference keypoints for tracking, built by the first tracking
+  double tracking_radius_;
+  mutable bool grid_built_;
+  mutable boost::mutex grid_mutex_;
+  mutable cv::Point2f grid_origin_;
+  mutable cv::Size grid_size_;
+  mutable std::vector< std::vector< int > > grid_cells_;
 };
 
 } // namespace affine_invariant_features
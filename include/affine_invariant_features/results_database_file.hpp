@@ -0,0 +1,261 @@
+#ifndef AFFINE_INVARIANT_FEATURES_RESULTS_DATABASE_FILE
+#define AFFINE_INVARIANT_FEATURES_RESULTS_DATABASE_FILE
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/results_file.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+#include <opencv2/core.hpp>
+
+namespace affine_invariant_features {
+
+//
+// Binary container of results of many targets, which can be loaded by a single mapping.
+// [header][results of target 0][results of target 1]...[table of contents]
+// Each results is in the binary results format (see results_file.hpp)
+// and begins at an offset aligned to ResultsFileHeader::descriptorAlignment.
+//
+
+struct DatabaseFileHeader {
+public:
+  static const char *magic() { return "AIFRSDB"; }
+
+  static const boost::uint32_t currentVersion = 1;
+
+public:
+  char magicBytes[8];
+  boost::uint32_t version;
+  boost::uint32_t endian;
+  boost::uint32_t nEntries;
+  boost::uint32_t reserved;
+  // offset of the table of contents from the beginning of the file in bytes
+  boost::uint64_t tocOffset;
+};
+
+struct DatabaseTocEntry {
+public:
+  boost::int32_t id;
+  boost::uint32_t reserved;
+  // offset from the beginning of the file and size of results in bytes
+  boost::uint64_t offset;
+  boost::uint64_t size;
+  boost::uint64_t paramsHash;
+  // md5 of the target image as 32 hex digits, or zeros if unknown
+  char md5[32];
+};
+
+//
+// Writer of a database file. Results are written as soon as they are added
+// so that all of them are not needed on memory at once.
+//
+
+class DatabaseFileWriter {
+public:
+  DatabaseFileWriter(const std::string &path) : ofs_(path.c_str(), std::ios::binary) {
+    CV_Assert(ofs_);
+    // the header is rewritten on closing
+    DatabaseFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    ofs_.write(reinterpret_cast< const char * >(&header), sizeof(header));
+  }
+
+  // close() should be called explicitly to know whether the file is complete
+  virtual ~DatabaseFileWriter() { close(); }
+
+  // the contour hash is stored in the header of results (see TargetDescription::hashContour())
+  void add(const int id, const Results &results, const boost::uint64_t params_hash = 0,
+           const std::string &md5 = std::string(), const boost::uint64_t contour_hash = 0) {
+    CV_Assert(ofs_.is_open() && md5.size() <= 32);
+    CV_Assert(ids_.insert(id).second);
+
+    DatabaseTocEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.id = id;
+    entry.offset = pad();
+    writeResults(ofs_, results, params_hash, contour_hash);
+    entry.size = static_cast< boost::uint64_t >(ofs_.tellp()) - entry.offset;
+    entry.paramsHash = params_hash;
+    std::memcpy(entry.md5, md5.data(), md5.size());
+    CV_Assert(ofs_);
+    toc_.push_back(entry);
+  }
+
+  // write the table of contents and the header.
+  // return false if the writer has been closed or any write has failed (e.g. on a full disk),
+  // in which case the file is broken.
+  bool close() {
+    if (!ofs_.is_open()) {
+      return false;
+    }
+
+    DatabaseFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::strncpy(header.magicBytes, DatabaseFileHeader::magic(), 8);
+    header.version = DatabaseFileHeader::currentVersion;
+    header.endian = ResultsFileHeader::endianTag;
+    header.nEntries = toc_.size();
+    header.tocOffset = pad();
+    if (!toc_.empty()) {
+      ofs_.write(reinterpret_cast< const char * >(&toc_[0]), toc_.size() * sizeof(toc_[0]));
+    }
+
+    ofs_.seekp(0);
+    ofs_.write(reinterpret_cast< const char * >(&header), sizeof(header));
+    // closing flushes buffered bytes, which may also fail
+    ofs_.close();
+    return !ofs_.fail();
+  }
+
+protected:
+  // pad the stream to the next aligned position and return the position
+  boost::uint64_t pad() {
+    const std::size_t pos(ofs_.tellp());
+    const std::size_t aligned(cv::alignSize(pos, ResultsFileHeader::descriptorAlignment));
+    for (std::size_t i = pos; i < aligned; ++i) {
+      ofs_.put('\0');
+    }
+    return aligned;
+  }
+
+protected:
+  std::ofstream ofs_;
+  std::vector< DatabaseTocEntry > toc_;
+  std::set< int > ids_;
+};
+
+//
+// A database file mapped on memory. Results of targets are accessible by their ids
+// and share the mapping, which is alive while any of them is alive.
+//
+
+class MappedDatabaseFile {
+public:
+  virtual ~MappedDatabaseFile() {}
+
+  // return an empty pointer if the file cannot be mapped or is not in the format
+  static cv::Ptr< MappedDatabaseFile > map(const std::string &path) {
+    namespace bi = boost::interprocess;
+
+    const cv::Ptr< MappedDatabaseFile > db(new MappedDatabaseFile());
+    try {
+      const bi::file_mapping mapping(path.c_str(), bi::read_only);
+      db->region_.reset(new bi::mapped_region(mapping, bi::read_only));
+    } catch (const bi::interprocess_exception & /* error */) {
+      return cv::Ptr< MappedDatabaseFile >();
+    }
+
+    const char *const data(db->data());
+    const std::size_t size(db->region_->get_size());
+    if (size < sizeof(DatabaseFileHeader)) {
+      return cv::Ptr< MappedDatabaseFile >();
+    }
+    const DatabaseFileHeader &header(*reinterpret_cast< const DatabaseFileHeader * >(data));
+    if (std::strncmp(header.magicBytes, DatabaseFileHeader::magic(), 8) != 0 ||
+        header.version != DatabaseFileHeader::currentVersion ||
+        header.endian != ResultsFileHeader::endianTag ||
+        // the table of contents must be in the file. checked by subtraction not to overflow.
+        header.tocOffset > size ||
+        header.nEntries > (size - header.tocOffset) / sizeof(DatabaseTocEntry) ||
+        // entries are read in place
+        header.tocOffset % boost::alignment_of< DatabaseTocEntry >::value != 0) {
+      return cv::Ptr< MappedDatabaseFile >();
+    }
+
+    db->toc_ = reinterpret_cast< const DatabaseTocEntry * >(data + header.tocOffset);
+    db->ntoc_ = header.nEntries;
+    for (int i = 0; i < db->ntoc_; ++i) {
+      const DatabaseTocEntry &entry(db->toc_[i]);
+      if (entry.offset > size || entry.size > size - entry.offset) {
+        return cv::Ptr< MappedDatabaseFile >();
+      }
+      db->indices_[entry.id] = i;
+    }
+    return db;
+  }
+
+  int size() const { return ntoc_; }
+
+  std::vector< int > getIds() const {
+    std::vector< int > ids;
+    for (int i = 0; i < ntoc_; ++i) {
+      ids.push_back(toc_[i].id);
+    }
+    return ids;
+  }
+
+  bool has(const int id) const { return indices_.count(id) > 0; }
+
+  // return NULL if no entry has the id
+  const DatabaseTocEntry *getEntry(const int id) const {
+    const std::map< int, int >::const_iterator index(indices_.find(id));
+    return index != indices_.end() ? &toc_[index->second] : NULL;
+  }
+
+  boost::uint64_t getParamsHash(const int id) const {
+    const DatabaseTocEntry *const entry(getEntry(id));
+    return entry ? entry->paramsHash : 0;
+  }
+
+  std::string getMD5(const int id) const {
+    const DatabaseTocEntry *const entry(getEntry(id));
+    return entry ? std::string(entry->md5, std::find(entry->md5, entry->md5 + 32, '\0'))
+                 : std::string();
+  }
+
+  // the number of keypoints read from the header of results, without decoding them.
+  // return -1 if no entry has the id.
+  int getNumKeypoints(const int id) const {
+    const DatabaseTocEntry *const entry(getEntry(id));
+    if (!entry || entry->size < sizeof(ResultsFileHeader)) {
+      return -1;
+    }
+    return reinterpret_cast< const ResultsFileHeader * >(data() + entry->offset)->nKeypoints;
+  }
+
+  // keypoints are decoded on each call but descriptors refer to the mapping.
+  // return an empty pointer if no entry has the id or the entry is broken.
+  cv::Ptr< MappedResults > getResults(const int id) const {
+    const DatabaseTocEntry *const entry(getEntry(id));
+    if (!entry) {
+      return cv::Ptr< MappedResults >();
+    }
+
+    const cv::Ptr< MappedResults > results(new MappedResults());
+    results->region = region_;
+    if (!parseResults(data() + entry->offset, entry->size, *results)) {
+      return cv::Ptr< MappedResults >();
+    }
+    return results;
+  }
+
+protected:
+  MappedDatabaseFile() : toc_(NULL), ntoc_(0) {}
+
+  const char *data() const { return static_cast< const char * >(region_->get_address()); }
+
+protected:
+  boost::shared_ptr< boost::interprocess::mapped_region > region_;
+  // table of contents in the mapping
+  const DatabaseTocEntry *toc_;
+  int ntoc_;
+  // index in the table of contents of each id
+  std::map< int, int > indices_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
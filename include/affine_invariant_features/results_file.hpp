@@ -0,0 +1,241 @@
+#ifndef AFFINE_INVARIANT_FEATURES_RESULTS_FILE
+#define AFFINE_INVARIANT_FEATURES_RESULTS_FILE
+
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <affine_invariant_features/results.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// Binary container of Results which can be memory-mapped.
+// [header][keypoint records][padding][descriptor rows aligned to descriptorAlignment]
+// Values are in the native byte order of the writer, which is checked by the endian tag.
+//
+
+struct ResultsFileHeader {
+public:
+  static const char *magic() { return "AIFRSLT"; }
+
+  static const boost::uint32_t currentVersion = 2;
+
+  static const boost::uint32_t endianTag = 0x01020304;
+
+  static const std::size_t descriptorAlignment = 64;
+
+public:
+  char magicBytes[8];
+  boost::uint32_t version;
+  boost::uint32_t endian;
+  boost::int32_t normType;
+  boost::int32_t nKeypoints;
+  boost::int32_t descriptorRows;
+  boost::int32_t descriptorCols;
+  boost::int32_t descriptorType;
+  boost::uint32_t reserved;
+  // hash of parameters which generated the results. 0 if unknown.
+  boost::uint64_t paramsHash;
+  // hash of the target contour which masked the extraction (TargetDescription::hashContour()).
+  // 0 if unknown.
+  boost::uint64_t contourHash;
+  // offsets from the beginning of the file in bytes
+  boost::uint64_t keypointsOffset;
+  boost::uint64_t descriptorsOffset;
+  // bytes per descriptor row
+  boost::uint64_t descriptorStep;
+};
+
+struct KeyPointRecord {
+public:
+  float x, y, size, angle, response;
+  boost::int32_t octave, classId;
+};
+
+//
+// Results whose descriptors refer to a mapped file.
+// The descriptors are valid while this object is alive.
+//
+
+struct MappedResults : public Results {
+public:
+  MappedResults() : paramsHash(0), contourHash(0) {}
+
+  virtual ~MappedResults() {}
+
+public:
+  boost::shared_ptr< boost::interprocess::mapped_region > region;
+  boost::uint64_t paramsHash;
+  boost::uint64_t contourHash;
+};
+
+// return true if the file begins with the magic of the binary format
+static inline bool isResultsFile(const std::string &path) {
+  std::ifstream ifs(path.c_str(), std::ios::binary);
+  char magic_bytes[8];
+  return ifs.read(magic_bytes, 8) && std::strncmp(magic_bytes, ResultsFileHeader::magic(), 8) == 0;
+}
+
+// write results in the binary format from the current position of the stream.
+// offsets in the header are relative to the position.
+static inline void writeResults(std::ostream &os, const Results &results,
+                                const boost::uint64_t params_hash = 0,
+                                const boost::uint64_t contour_hash = 0) {
+  ResultsFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::strncpy(header.magicBytes, ResultsFileHeader::magic(), 8);
+  header.version = ResultsFileHeader::currentVersion;
+  header.endian = ResultsFileHeader::endianTag;
+  header.normType = results.normType;
+  header.nKeypoints = results.keypoints.size();
+  header.descriptorRows = results.descriptors.rows;
+  header.descriptorCols = results.descriptors.cols;
+  header.descriptorType = results.descriptors.type();
+  header.paramsHash = params_hash;
+  header.contourHash = contour_hash;
+  header.keypointsOffset = sizeof(ResultsFileHeader);
+  header.descriptorsOffset =
+      cv::alignSize(header.keypointsOffset + header.nKeypoints * sizeof(KeyPointRecord),
+                    ResultsFileHeader::descriptorAlignment);
+  header.descriptorStep = results.descriptors.cols * results.descriptors.elemSize();
+  os.write(reinterpret_cast< const char * >(&header), sizeof(header));
+
+  for (std::vector< cv::KeyPoint >::const_iterator keypoint = results.keypoints.begin();
+       keypoint != results.keypoints.end(); ++keypoint) {
+    const KeyPointRecord record = {keypoint->pt.x,     keypoint->pt.y,     keypoint->size,
+                                   keypoint->angle,    keypoint->response, keypoint->octave,
+                                   keypoint->class_id};
+    os.write(reinterpret_cast< const char * >(&record), sizeof(record));
+  }
+
+  // padding to align descriptors
+  const std::vector< char > padding(header.descriptorsOffset - header.keypointsOffset -
+                                        header.nKeypoints * sizeof(KeyPointRecord),
+                                    0);
+  if (!padding.empty()) {
+    os.write(&padding[0], padding.size());
+  }
+
+  for (int r = 0; r < results.descriptors.rows; ++r) {
+    os.write(reinterpret_cast< const char * >(results.descriptors.ptr(r)), header.descriptorStep);
+  }
+}
+
+// write results in a binary file
+static inline void writeResultsFile(const std::string &path, const Results &results,
+                                    const boost::uint64_t params_hash = 0,
+                                    const boost::uint64_t contour_hash = 0) {
+  std::ofstream ofs(path.c_str(), std::ios::binary);
+  CV_Assert(ofs);
+  writeResults(ofs, results, params_hash, contour_hash);
+  CV_Assert(ofs);
+}
+
+// validate a header of the binary format in a buffer of the given size
+// so that a broken header is rejected before its values are used to make cv::Mat
+static inline bool isValidHeader(const ResultsFileHeader &header, const std::size_t size) {
+  if (std::strncmp(header.magicBytes, ResultsFileHeader::magic(), 8) != 0 ||
+      header.version != ResultsFileHeader::currentVersion ||
+      header.endian != ResultsFileHeader::endianTag || header.nKeypoints < 0 ||
+      header.descriptorRows < 0 || header.descriptorCols < 0) {
+    return false;
+  }
+
+  // type and layout of descriptors
+  const int type(header.descriptorType);
+  if (type < 0 || type != CV_MAT_TYPE(type) || CV_MAT_DEPTH(type) > CV_64F ||
+      header.descriptorStep < static_cast< boost::uint64_t >(header.descriptorCols) *
+                                  CV_ELEM_SIZE(type) ||
+      header.descriptorStep % CV_ELEM_SIZE1(type) != 0 ||
+      header.descriptorsOffset % ResultsFileHeader::descriptorAlignment != 0) {
+    return false;
+  }
+
+  // ranges in the buffer. compared by subtraction so that any sum does not wrap around.
+  // the number of keypoints times the record size never wraps around as it is 32-bit.
+  if (header.keypointsOffset > size ||
+      header.nKeypoints * sizeof(KeyPointRecord) > size - header.keypointsOffset) {
+    return false;
+  }
+  if (header.descriptorsOffset > size ||
+      (header.descriptorRows > 0 &&
+       header.descriptorStep > (size - header.descriptorsOffset) / header.descriptorRows)) {
+    return false;
+  }
+  return true;
+}
+
+// decode keypoint records
+static inline void readKeyPoints(const KeyPointRecord *records, const int nkeypoints,
+                                 std::vector< cv::KeyPoint > &keypoints) {
+  keypoints.resize(nkeypoints);
+  for (int i = 0; i < nkeypoints; ++i) {
+    const KeyPointRecord &record(records[i]);
+    keypoints[i] = cv::KeyPoint(record.x, record.y, record.size, record.angle, record.response,
+                                record.octave, record.classId);
+  }
+}
+
+// parse results in the binary format in a mapped buffer which must be aligned to
+// descriptorAlignment. descriptors are not copied but refer to the buffer.
+// return false if the buffer is not in the format.
+static inline bool parseResults(const char *data, const std::size_t size, MappedResults &results) {
+  if (size < sizeof(ResultsFileHeader)) {
+    return false;
+  }
+  const ResultsFileHeader &header(*reinterpret_cast< const ResultsFileHeader * >(data));
+  if (!isValidHeader(header, size)) {
+    return false;
+  }
+
+  readKeyPoints(reinterpret_cast< const KeyPointRecord * >(data + header.keypointsOffset),
+                header.nKeypoints, results.keypoints);
+  // the mapping is read-only. never modify the descriptors.
+  results.descriptors = cv::Mat(header.descriptorRows, header.descriptorCols,
+                                header.descriptorType,
+                                const_cast< char * >(data + header.descriptorsOffset),
+                                header.descriptorStep);
+  results.normType = header.normType;
+  results.paramsHash = header.paramsHash;
+  results.contourHash = header.contourHash;
+  return true;
+}
+
+// map a file in the binary format.
+// return an empty pointer if the file cannot be mapped or is not in the format.
+// if expected_params_hash is not 0, results by other or unknown parameters are also refused.
+static inline cv::Ptr< MappedResults >
+mapResultsFile(const std::string &path, const boost::uint64_t expected_params_hash = 0) {
+  namespace bi = boost::interprocess;
+
+  const cv::Ptr< MappedResults > results(new MappedResults());
+  try {
+    const bi::file_mapping mapping(path.c_str(), bi::read_only);
+    results->region.reset(new bi::mapped_region(mapping, bi::read_only));
+  } catch (const bi::interprocess_exception & /* error */) {
+    return cv::Ptr< MappedResults >();
+  }
+
+  if (!parseResults(static_cast< const char * >(results->region->get_address()),
+                    results->region->get_size(), *results) ||
+      (expected_params_hash != 0 && results->paramsHash != expected_params_hash)) {
+    return cv::Ptr< MappedResults >();
+  }
+  return results;
+}
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
@@ -0,0 +1,297 @@
+#ifndef AFFINE_INVARIANT_FEATURES_SKETCH_MATCHER
+#define AFFINE_INVARIANT_FEATURES_SKETCH_MATCHER
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A two-stage matcher for NORM_L2 descriptors.
+// Each descriptor is summarized as a binary sketch, the signs of random projections
+// of the descriptor centered by the mean of training descriptors.
+// Candidates are found by hamming distances between sketches, which are much cheaper
+// than float distances, and only the top nreranks candidates are re-ranked by exact L2 distances.
+//
+
+class SketchMatcher : public cv::DescriptorMatcher {
+protected:
+  // a pair of a distance and a descriptor id
+  typedef std::pair< int, int > HammingCandidate;
+  typedef std::pair< float, int > Candidate;
+
+public:
+  SketchMatcher(const int nbits = 256, const int nreranks = 32)
+      : nbits_(nbits), nreranks_(nreranks), offsets_(1, 0) {
+    CV_Assert(nbits_ > 0 && nbits_ % 8 == 0 && nreranks_ > 0);
+  }
+
+  virtual ~SketchMatcher() {}
+
+  static cv::Ptr< SketchMatcher > create(const int nbits = 256, const int nreranks = 32) {
+    return new SketchMatcher(nbits, nreranks);
+  }
+
+  //
+  // overloaded functions from cv::DescriptorMatcher or its base class
+  //
+
+  virtual void clear() {
+    cv::DescriptorMatcher::clear();
+    mean_.release();
+    projection_.release();
+    sketches_.release();
+    rows_.clear();
+    offsets_.assign(1, 0);
+  }
+
+  virtual bool isMaskSupported() const { return false; }
+
+  virtual void train() {
+    // nothing to do if all added descriptors have been sketched
+    if (trainDescCollection.size() + 1 <= offsets_.size()) {
+      return;
+    }
+
+    // learn the projection on the first training. later additions reuse it.
+    // the matcher stays untrained until any descriptors are added.
+    if (projection_.empty() && !trainProjection()) {
+      return;
+    }
+
+    for (std::size_t i = offsets_.size() - 1; i < trainDescCollection.size(); ++i) {
+      const cv::Mat &descriptors(trainDescCollection[i]);
+      // an image without descriptors takes no ids
+      if (descriptors.empty()) {
+        offsets_.push_back(rows_.size());
+        continue;
+      }
+      CV_Assert(descriptors.type() == CV_32FC1 && descriptors.cols == projection_.cols);
+      cv::Mat sketches;
+      sketch(descriptors, sketches);
+      sketches_.push_back(sketches);
+      for (int r = 0; r < descriptors.rows; ++r) {
+        rows_.push_back(descriptors.ptr< float >(r));
+      }
+      offsets_.push_back(rows_.size());
+    }
+  }
+
+  // sketches are not stored because they are quickly computed from descriptors
+  virtual void read(const cv::FileNode &fn) {
+    clear();
+    fn["nbits"] >> nbits_;
+    fn["nreranks"] >> nreranks_;
+    fn["mean"] >> mean_;
+    fn["projection"] >> projection_;
+    const cv::FileNode descriptors_node(fn["descriptors"]);
+    trainDescCollection.resize(descriptors_node.isSeq() ? descriptors_node.size() : 0);
+    for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+      descriptors_node[i] >> trainDescCollection[i];
+    }
+    train();
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "nbits" << nbits_;
+    fs << "nreranks" << nreranks_;
+    fs << "mean" << mean_;
+    fs << "projection" << projection_;
+    fs << "descriptors";
+    fs << "[";
+    for (std::size_t i = 0; i + 1 < offsets_.size(); ++i) {
+      fs << trainDescCollection[i];
+    }
+    fs << "]";
+  }
+
+  virtual cv::Ptr< cv::DescriptorMatcher > clone(const bool emptyTrainData = false) const {
+    const cv::Ptr< SketchMatcher > matcher(new SketchMatcher(nbits_, nreranks_));
+    if (!emptyTrainData) {
+      matcher->trainDescCollection = trainDescCollection;
+      matcher->mean_ = mean_.clone();
+      matcher->projection_ = projection_.clone();
+      matcher->sketches_ = sketches_.clone();
+      matcher->rows_ = rows_;
+      matcher->offsets_ = offsets_;
+    }
+    return matcher;
+  }
+
+  virtual cv::String getDefaultName() const { return "SketchMatcher"; }
+
+protected:
+  virtual void knnMatchImpl(cv::InputArray queryDescriptors,
+                            std::vector< std::vector< cv::DMatch > > &matches, int k,
+                            cv::InputArrayOfArrays /* masks */, bool /* compactResult */) {
+    const cv::Mat query(queryDescriptors.getMat());
+
+    matches.clear();
+    matches.resize(query.rows);
+    if (projection_.empty()) {
+      return;
+    }
+    CV_Assert(query.type() == CV_32FC1 && query.cols == projection_.cols);
+
+    cv::Mat query_sketches;
+    sketch(query, query_sketches);
+
+    std::vector< Candidate > candidates;
+    for (int i = 0; i < query.rows; ++i) {
+      search(query.ptr< float >(i), query_sketches.ptr< uchar >(i), candidates);
+      for (int c = 0; c < k && c < static_cast< int >(candidates.size()); ++c) {
+        matches[i].push_back(toDMatch(i, candidates[c]));
+      }
+    }
+  }
+
+  // approximate. only the re-ranked candidates are examined.
+  virtual void radiusMatchImpl(cv::InputArray queryDescriptors,
+                               std::vector< std::vector< cv::DMatch > > &matches,
+                               float maxDistance, cv::InputArrayOfArrays /* masks */,
+                               bool /* compactResult */) {
+    const cv::Mat query(queryDescriptors.getMat());
+
+    matches.clear();
+    matches.resize(query.rows);
+    if (projection_.empty()) {
+      return;
+    }
+    CV_Assert(query.type() == CV_32FC1 && query.cols == projection_.cols);
+
+    cv::Mat query_sketches;
+    sketch(query, query_sketches);
+
+    std::vector< Candidate > candidates;
+    for (int i = 0; i < query.rows; ++i) {
+      search(query.ptr< float >(i), query_sketches.ptr< uchar >(i), candidates);
+      for (std::size_t c = 0; c < candidates.size(); ++c) {
+        const cv::DMatch match(toDMatch(i, candidates[c]));
+        if (match.distance > maxDistance) {
+          break;
+        }
+        matches[i].push_back(match);
+      }
+    }
+  }
+
+  // return false if no descriptors have been added
+  bool trainProjection() {
+    // mean of all added descriptors
+    int nrows(0);
+    for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+      const cv::Mat &descriptors(trainDescCollection[i]);
+      if (descriptors.empty()) {
+        continue;
+      }
+      CV_Assert(descriptors.type() == CV_32FC1);
+      CV_Assert(mean_.empty() || descriptors.cols == mean_.cols);
+      if (mean_.empty()) {
+        mean_ = cv::Mat::zeros(1, descriptors.cols, CV_64FC1);
+      }
+      for (int r = 0; r < descriptors.rows; ++r) {
+        cv::Mat row;
+        descriptors.row(r).convertTo(row, CV_64F);
+        mean_ += row;
+      }
+      nrows += descriptors.rows;
+    }
+    if (nrows == 0) {
+      return false;
+    }
+    mean_.convertTo(mean_, CV_32F, 1. / nrows);
+
+    // gaussian random projection with a fixed seed for reproducible sketches
+    projection_.create(nbits_, mean_.cols, CV_32FC1);
+    cv::RNG rng(0x12345678);
+    rng.fill(projection_, cv::RNG::NORMAL, 0., 1.);
+    return true;
+  }
+
+  // pack signs of projections of centered descriptors into bits
+  void sketch(const cv::Mat &descriptors, cv::Mat &sketches) const {
+    sketches = cv::Mat::zeros(descriptors.rows, nbits_ / 8, CV_8UC1);
+    if (descriptors.empty()) {
+      return;
+    }
+
+    cv::Mat centered(descriptors.rows, descriptors.cols, CV_32FC1);
+    for (int r = 0; r < descriptors.rows; ++r) {
+      cv::Mat row(centered.row(r));
+      cv::subtract(descriptors.row(r), mean_, row);
+    }
+    cv::Mat projected;
+    cv::gemm(centered, projection_, 1., cv::noArray(), 0., projected, cv::GEMM_2_T);
+
+    for (int r = 0; r < projected.rows; ++r) {
+      const float *const values(projected.ptr< float >(r));
+      uchar *const bits(sketches.ptr< uchar >(r));
+      for (int b = 0; b < nbits_; ++b) {
+        if (values[b] > 0.f) {
+          bits[b >> 3] |= 1 << (b & 7);
+        }
+      }
+    }
+  }
+
+  // re-rank the nearest sketches by exact distances.
+  // candidates are sorted by their squared L2 distances.
+  void search(const float *query, const uchar *query_sketch,
+              std::vector< Candidate > &candidates) const {
+    candidates.clear();
+    const int nrows(rows_.size());
+    if (nrows == 0) {
+      return;
+    }
+
+    // hamming distances to all sketches
+    std::vector< HammingCandidate > hamming_candidates(nrows);
+    for (int id = 0; id < nrows; ++id) {
+      hamming_candidates[id] =
+          HammingCandidate(cv::hal::normHamming(query_sketch, sketches_.ptr< uchar >(id),
+                                                sketches_.cols),
+                           id);
+    }
+    const int nreranks(std::min(nreranks_, nrows));
+    std::nth_element(hamming_candidates.begin(), hamming_candidates.begin() + nreranks - 1,
+                     hamming_candidates.end());
+
+    // exact distances of the top candidates
+    const int dims(projection_.cols);
+    for (int c = 0; c < nreranks; ++c) {
+      const int id(hamming_candidates[c].second);
+      candidates.push_back(Candidate(cv::hal::normL2Sqr_(query, rows_[id], dims), id));
+    }
+    std::sort(candidates.begin(), candidates.end());
+  }
+
+  cv::DMatch toDMatch(const int query_idx, const Candidate &candidate) const {
+    const int img(std::upper_bound(offsets_.begin(), offsets_.end(), candidate.second) -
+                  offsets_.begin() - 1);
+    return cv::DMatch(query_idx, candidate.second - offsets_[img], img,
+                      std::sqrt(candidate.first));
+  }
+
+protected:
+  int nbits_;
+  int nreranks_;
+
+  cv::Mat mean_;
+  // a random vector of each bit in each row
+  cv::Mat projection_;
+  // sketches of all descriptors
+  cv::Mat sketches_;
+  // row pointers of all descriptors, which are owned by trainDescCollection
+  std::vector< const float * > rows_;
+  // the first id of each image and the total number of ids
+  std::vector< int > offsets_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
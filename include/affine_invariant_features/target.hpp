@@ -3,6 +3,7 @@
 
 #include <fstream>
 #include <iomanip>
+#include <map>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -10,8 +11,18 @@
 #include <ros/package.h>
 
 #include <affine_invariant_features/cv_serializable.hpp>
+#include <affine_invariant_features/hash.hpp>
+#include <affine_invariant_features/parallel_tasks.hpp>
 
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
@@ -31,6 +42,7 @@ public:
     fn["package"] >> package;
     fn["path"] >> path;
     fn["md5"] >> md5;
+    fn["xxh64"] >> xxh64;
     const cv::FileNode contour_node(fn["contour"]);
     const std::size_t contour_size(contour_node.isSeq() ? contour_node.size() : 0);
     contour.resize(contour_size);
@@ -43,6 +55,9 @@ public:
     fs << "package" << package;
     fs << "path" << path;
     fs << "md5" << md5;
+    if (!xxh64.empty()) {
+      fs << "xxh64" << xxh64;
+    }
     fs << "contour";
     fs << "[:";
     for (std::vector< cv::Point >::const_iterator point = contour.begin(); point != contour.end();
@@ -54,12 +69,22 @@ public:
 
   virtual std::string getDefaultName() const { return "TargetDescription"; }
 
+  // canonical hash of the contour, which defines the mask of feature extraction
+  boost::uint64_t hashContour() const {
+    boost::uint64_t hash(fnv1a64Value< boost::uint64_t >(contour.size()));
+    for (std::vector< cv::Point >::const_iterator point = contour.begin(); point != contour.end();
+         ++point) {
+      hash = fnv1a64Value< boost::int32_t >(point->x, hash);
+      hash = fnv1a64Value< boost::int32_t >(point->y, hash);
+    }
+    return hash;
+  }
+
 public:
   static std::string resolvePath(const std::string &package, const std::string &path) {
     namespace bf = boost::filesystem;
-    namespace rp = ros::package;
 
-    const bf::path root_path(package.empty() ? std::string() : rp::getPath(package));
+    const bf::path root_path(package.empty() ? std::string() : getPackagePath(package));
     const bf::path leaf_path(path);
     if (root_path.empty() || leaf_path.empty() || leaf_path.is_absolute()) {
       return leaf_path.string();
@@ -67,44 +92,157 @@ public:
     return (root_path / leaf_path).string();
   }
 
-  static std::string generateMD5(const std::string &path) {
-    // open the file path as a binary file
-    std::ifstream ifs(path.c_str(), std::ios::binary);
-    if (!ifs) {
-      return std::string();
+  // resolve paths of many targets. each package is looked up once by the cache.
+  // lookups are serial because ros::package::getPath serializes calls of rospack by a lock.
+  static std::vector< std::string > resolvePaths(const std::vector< TargetDescription > &descs) {
+    std::vector< std::string > paths;
+    for (std::vector< TargetDescription >::const_iterator desc = descs.begin(); desc != descs.end();
+         ++desc) {
+      paths.push_back(resolvePath(desc->package, desc->path));
     }
+    return paths;
+  }
 
-    // calculate the MD5 hash using openSSL library
-    unsigned char md5[MD5_DIGEST_LENGTH];
+  // root path of the package, or an empty string if not found.
+  // memoised because ros::package::getPath runs rospack, which takes tens of milliseconds or more.
+  // a package not found is not memoised so that it is found once installed.
+  static std::string getPackagePath(const std::string &package) {
     {
-      MD5_CTX ctx;
-      MD5_Init(&ctx);
-      char buf[4096];
-      while (ifs.read(buf, 4096) || ifs.gcount()) {
-        MD5_Update(&ctx, buf, ifs.gcount());
+      boost::lock_guard< boost::mutex > lock(packagePathMutex());
+      const std::map< std::string, std::string > &cache(packagePathCache());
+      const std::map< std::string, std::string >::const_iterator path(cache.find(package));
+      if (path != cache.end()) {
+        return path->second;
       }
-      MD5_Final(md5, &ctx);
     }
 
+    // the slow lookup is out of the lock. concurrent lookups of a package give the same path.
+    const std::string path(ros::package::getPath(package));
+    if (!path.empty()) {
+      boost::lock_guard< boost::mutex > lock(packagePathMutex());
+      packagePathCache()[package] = path;
+    }
+    return path;
+  }
+
+  // forget cached package paths, for example after ROS_PACKAGE_PATH is changed
+  static void clearPackagePathCache() {
+    boost::lock_guard< boost::mutex > lock(packagePathMutex());
+    packagePathCache().clear();
+  }
+
+  static void clearPackagePathCache(const std::string &package) {
+    boost::lock_guard< boost::mutex > lock(packagePathMutex());
+    packagePathCache().erase(package);
+  }
+
+  // a function to stringize the hash of bytes
+  typedef std::string (*HashFunction)(const void *, const std::size_t);
+
+  static std::string generateMD5(const std::string &path) { return generateHash(path, &hashMD5); }
+
+  // xxh64 is a much faster alternative to md5 for detecting changes of files
+  static std::string generateXXH64(const std::string &path) {
+    return generateHash(path, &hashXXH64);
+  }
+
+  // hash files in parallel. an empty string for each file which cannot be read.
+  static std::vector< std::string > generateMD5(const std::vector< std::string > &paths,
+                                                const double nstripes = -1.) {
+    return generateHashes(paths, &hashMD5, nstripes);
+  }
+
+  static std::vector< std::string > generateXXH64(const std::vector< std::string > &paths,
+                                                  const double nstripes = -1.) {
+    return generateHashes(paths, &hashXXH64, nstripes);
+  }
+
+  // hash the file mapped on memory at once, or return an empty string if it cannot be read
+  static std::string generateHash(const std::string &path, const HashFunction hash_function) {
+    namespace bf = boost::filesystem;
+    namespace bi = boost::interprocess;
+
+    boost::system::error_code error;
+    if (!bf::is_regular_file(path, error)) {
+      return std::string();
+    }
+    // an empty file cannot be mapped
+    if (bf::file_size(path, error) == 0) {
+      return hash_function("", 0);
+    }
+
+    try {
+      const bi::file_mapping mapping(path.c_str(), bi::read_only);
+      bi::mapped_region region(mapping, bi::read_only);
+      region.advise(bi::mapped_region::advice_sequential);
+      return hash_function(region.get_address(), region.get_size());
+    } catch (const bi::interprocess_exception & /* error */) {
+      return std::string();
+    }
+  }
+
+  static std::vector< std::string > generateHashes(const std::vector< std::string > &paths,
+                                                   const HashFunction hash_function,
+                                                   const double nstripes = -1.) {
+    std::vector< std::string > hashes(paths.size());
+    ParallelTasks tasks(paths.size());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+      tasks[i] = boost::bind(&generateHashTo, boost::cref(paths[i]), hash_function,
+                             boost::ref(hashes[i]));
+    }
+    cv::parallel_for_(cv::Range(0, tasks.size()), tasks, nstripes);
+    return hashes;
+  }
+
+  static std::string hashMD5(const void *data, const std::size_t size) {
+    // calculate the MD5 hash using openSSL library
+    unsigned char md5[MD5_DIGEST_LENGTH];
+    MD5(static_cast< const unsigned char * >(data), size, md5);
+
     // stringaze the MD5 hash
     std::ostringstream oss;
     for (int i = 0; i < MD5_DIGEST_LENGTH; ++i) {
       oss << std::hex << std::setw(2) << std::setfill('0') << static_cast< int >(md5[i]);
     }
+    return oss.str();
+  }
 
+  static std::string hashXXH64(const void *data, const std::size_t size) {
+    std::ostringstream oss;
+    oss << std::hex << std::setw(16) << std::setfill('0')
+        << affine_invariant_features::xxh64(data, size);
     return oss.str();
   }
 
+protected:
+  // process-wide cache of package paths
+  static std::map< std::string, std::string > &packagePathCache() {
+    static std::map< std::string, std::string > cache;
+    return cache;
+  }
+
+  static boost::mutex &packagePathMutex() {
+    static boost::mutex mutex;
+    return mutex;
+  }
+
+  static void generateHashTo(const std::string &path, const HashFunction hash_function,
+                             std::string &hash) {
+    hash = generateHash(path, hash_function);
+  }
+
 public:
   std::string package;
   std::string path;
   std::string md5;
+  // optional. checked instead of md5 if not empty.
+  std::string xxh64;
   std::vector< cv::Point > contour;
 };
 
 struct TargetData : public CvSerializable {
 public:
-  TargetData() {}
+  TargetData() : reduction(1) {}
 
   virtual ~TargetData() {}
 
@@ -121,35 +259,155 @@ public:
   virtual std::string getDefaultName() const { return "TargetData"; }
 
 public:
+  // imread_flags can be cv::IMREAD_GRAYSCALE or cv::IMREAD_REDUCED_* to decode the image
+  // directly in grayscale or at a reduced resolution, which is faster and smaller.
+  // OpenCV older than 3.2 has no cv::IMREAD_REDUCED_* and the same values of flags decode
+  // the image at the full resolution and shrink it, which is smaller but not faster.
+  // the mask is generated at the resolution of the decoded image.
   static cv::Ptr< TargetData > retrieve(const TargetDescription &desc,
-                                        const bool check_md5 = false) {
+                                        const bool check_hash = false,
+                                        const int imread_flags = cv::IMREAD_COLOR) {
     const std::string path(TargetDescription::resolvePath(desc.package, desc.path));
     if (path.empty()) {
       return cv::Ptr< TargetData >();
     }
 
-    if (check_md5) {
-      if (desc.md5.empty() || desc.md5 != TargetDescription::generateMD5(path)) {
+    // check the faster hash if described
+    if (check_hash) {
+      const bool ok(!desc.xxh64.empty()
+                        ? desc.xxh64 == TargetDescription::generateXXH64(path)
+                        : !desc.md5.empty() && desc.md5 == TargetDescription::generateMD5(path));
+      if (!ok) {
         return cv::Ptr< TargetData >();
       }
     }
 
     const cv::Ptr< TargetData > data(new TargetData());
-    data->image = cv::imread(path);
+    data->reduction = getReduction(imread_flags);
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 2)
+    data->image = cv::imread(path, imread_flags);
+#else
+    if (data->reduction > 1) {
+      // the rest of flags selects grayscale or color
+      const cv::Mat image(
+          cv::imread(path, imread_flags & ~(ReducedFlag2 | ReducedFlag4 | ReducedFlag8)));
+      if (!image.empty()) {
+        // round up the size as the reduced decoding does
+        cv::resize(image, data->image,
+                   cv::Size((image.cols + data->reduction - 1) / data->reduction,
+                            (image.rows + data->reduction - 1) / data->reduction),
+                   0., 0., cv::INTER_AREA);
+      }
+    } else {
+      data->image = cv::imread(path, imread_flags);
+    }
+#endif
     if (data->image.empty()) {
       return cv::Ptr< TargetData >();
     }
 
     if (!desc.contour.empty()) {
+      // the contour is described at the full resolution
+      std::vector< cv::Point > contour;
+      for (std::vector< cv::Point >::const_iterator point = desc.contour.begin();
+           point != desc.contour.end(); ++point) {
+        contour.push_back(cv::Point(cvRound(static_cast< double >(point->x) / data->reduction),
+                                    cvRound(static_cast< double >(point->y) / data->reduction)));
+      }
       data->mask = cv::Mat::zeros(data->image.size(), CV_8UC1);
-      cv::fillPoly(data->mask, std::vector< std::vector< cv::Point > >(1, desc.contour), 255);
+      cv::fillPoly(data->mask, std::vector< std::vector< cv::Point > >(1, contour), 255);
     }
     return data;
   }
 
+  // the factor of reduction by cv::IMREAD_REDUCED_* flags.
+  // each cv::IMREAD_REDUCED_GRAYSCALE_* is a bit which the color variant also has.
+  static int getReduction(const int imread_flags) {
+    if (imread_flags < 0) { // cv::IMREAD_UNCHANGED
+      return 1;
+    } else if (imread_flags & ReducedFlag8) {
+      return 8;
+    } else if (imread_flags & ReducedFlag4) {
+      return 4;
+    } else if (imread_flags & ReducedFlag2) {
+      return 2;
+    }
+    return 1;
+  }
+
+protected:
+  // bits of cv::IMREAD_REDUCED_GRAYSCALE_*, with the same values for OpenCV older than 3.2
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 2)
+  enum {
+    ReducedFlag2 = cv::IMREAD_REDUCED_GRAYSCALE_2,
+    ReducedFlag4 = cv::IMREAD_REDUCED_GRAYSCALE_4,
+    ReducedFlag8 = cv::IMREAD_REDUCED_GRAYSCALE_8
+  };
+#else
+  enum { ReducedFlag2 = 16, ReducedFlag4 = 32, ReducedFlag8 = 64 };
+#endif
+
 public:
   cv::Mat image;
   cv::Mat mask;
+  // the full resolution is this times the resolution of image and mask
+  int reduction;
+};
+
+//
+// A handle of target data which resolves the path of the target image on reading
+// but defers decoding the image until the data is requested. Not thread-safe.
+//
+
+struct LazyTargetData : public CvSerializable {
+public:
+  LazyTargetData() : imread_flags_(cv::IMREAD_COLOR), retrieved_(false) {}
+
+  virtual ~LazyTargetData() {}
+
+  virtual void read(const cv::FileNode &fn) {
+    desc_.read(fn);
+    path_ = TargetDescription::resolvePath(desc_.package, desc_.path);
+    data_.release();
+    retrieved_ = false;
+  }
+
+  virtual void write(cv::FileStorage &fs) const { desc_.write(fs); }
+
+  // same as TargetDescription so that load< LazyTargetData > reads a target description
+  virtual std::string getDefaultName() const { return desc_.getDefaultName(); }
+
+public:
+  const TargetDescription &getDescription() const { return desc_; }
+
+  const std::string &getPath() const { return path_; }
+
+  int getImreadFlags() const { return imread_flags_; }
+
+  // flags given to TargetData::retrieve(). the data is decoded again on the next request.
+  void setImreadFlags(const int imread_flags) {
+    imread_flags_ = imread_flags;
+    data_.release();
+    retrieved_ = false;
+  }
+
+  bool isRetrieved() const { return retrieved_; }
+
+  // decode the image on the first call. return an empty pointer if the image cannot be decoded.
+  cv::Ptr< const TargetData > getData() const {
+    if (!retrieved_) {
+      data_ = TargetData::retrieve(desc_, false, imread_flags_);
+      retrieved_ = true;
+    }
+    return data_;
+  }
+
+protected:
+  TargetDescription desc_;
+  std::string path_;
+  int imread_flags_;
+  mutable bool retrieved_;
+  mutable cv::Ptr< const TargetData > data_;
 };
 
 template <> cv::Ptr< TargetData > load< TargetData >(const cv::FileNode &fn) {
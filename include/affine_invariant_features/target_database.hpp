@@ -0,0 +1,137 @@
+#ifndef AFFINE_INVARIANT_FEATURES_TARGET_DATABASE
+#define AFFINE_INVARIANT_FEATURES_TARGET_DATABASE
+
+#include <algorithm>
+#include <vector>
+
+#include <affine_invariant_features/result_matcher.hpp>
+#include <affine_invariant_features/results.hpp>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A mutable set of targets which keeps serving queries while targets are inserted or removed.
+// Each target has its own index so that inserting or removing a target does not rebuild others.
+//
+
+class TargetDatabase {
+protected:
+  struct Entry {
+  public:
+    Entry(const int id, const cv::Ptr< const ResultMatcher > &matcher, const double min_match_ratio)
+        : id(id), matcher(matcher), minMatchRatio(min_match_ratio) {}
+
+  public:
+    int id;
+    cv::Ptr< const ResultMatcher > matcher;
+    double minMatchRatio;
+  };
+
+public:
+  TargetDatabase() : next_id_(0) {}
+
+  virtual ~TargetDatabase() {}
+
+  // insert a target and return its id. the index of the target is built
+  // before the database is locked so that queries are not blocked during the build.
+  int insert(const cv::Ptr< const Results > &reference, const double min_match_ratio = 0.,
+             const cv::Ptr< cv::DescriptorMatcher > &matcher = cv::Ptr< cv::DescriptorMatcher >()) {
+    return insert(cv::Ptr< const ResultMatcher >(new ResultMatcher(reference, matcher)),
+                  min_match_ratio);
+  }
+
+  int insert(const cv::Ptr< const ResultMatcher > &matcher, const double min_match_ratio = 0.) {
+    CV_Assert(matcher);
+
+    boost::unique_lock< boost::shared_mutex > lock(mutex_);
+    const int id(next_id_++);
+    entries_.push_back(Entry(id, matcher, min_match_ratio));
+    return id;
+  }
+
+  // erase the target. return false if no target has the id.
+  // queries running on a snapshot of targets keep the matcher of the target alive.
+  bool remove(const int id) {
+    // the matcher is released after unlocking because releasing a large index may take time
+    cv::Ptr< const ResultMatcher > matcher;
+    {
+      boost::unique_lock< boost::shared_mutex > lock(mutex_);
+      const std::vector< Entry >::iterator entry(find(id));
+      if (entry == entries_.end()) {
+        return false;
+      }
+      matcher = entry->matcher;
+      entries_.erase(entry);
+    }
+    return true;
+  }
+
+  std::size_t size() const {
+    boost::shared_lock< boost::shared_mutex > lock(mutex_);
+    return entries_.size();
+  }
+
+  cv::Ptr< const ResultMatcher > getMatcher(const int id) const {
+    boost::shared_lock< boost::shared_mutex > lock(mutex_);
+    const std::vector< Entry >::const_iterator entry(find(id));
+    return entry == entries_.end() ? cv::Ptr< const ResultMatcher >() : entry->matcher;
+  }
+
+  // match the source to all targets in parallel.
+  // the database is locked only while taking a snapshot of targets
+  // so that insertions and removals are not blocked during matching.
+  void match(const Results &source, std::vector< int > &ids,
+             std::vector< cv::Matx33f > &transforms,
+             std::vector< std::vector< cv::DMatch > > &matches_array, const double nstripes = -1.,
+             std::vector< VerificationReport > *reports = NULL) const {
+    std::vector< cv::Ptr< const ResultMatcher > > matchers;
+    std::vector< double > min_match_ratios;
+    ids.clear();
+    {
+      boost::shared_lock< boost::shared_mutex > lock(mutex_);
+      for (std::vector< Entry >::const_iterator entry = entries_.begin(); entry != entries_.end();
+           ++entry) {
+        ids.push_back(entry->id);
+        matchers.push_back(entry->matcher);
+        min_match_ratios.push_back(entry->minMatchRatio);
+      }
+    }
+
+    transforms.clear();
+    matches_array.clear();
+    ResultMatcher::parallelMatch(matchers, source, transforms, matches_array, min_match_ratios,
+                                 nstripes, reports);
+  }
+
+protected:
+  // entries are sorted by their ids because ids are given in ascending order
+  // and erasing an entry keeps the order
+  std::vector< Entry >::iterator find(const int id) {
+    const std::vector< Entry >::iterator entry(
+        std::lower_bound(entries_.begin(), entries_.end(), id, lessId));
+    return (entry != entries_.end() && entry->id == id) ? entry : entries_.end();
+  }
+
+  std::vector< Entry >::const_iterator find(const int id) const {
+    const std::vector< Entry >::const_iterator entry(
+        std::lower_bound(entries_.begin(), entries_.end(), id, lessId));
+    return (entry != entries_.end() && entry->id == id) ? entry : entries_.end();
+  }
+
+  static bool lessId(const Entry &entry, const int id) { return entry.id < id; }
+
+protected:
+  mutable boost::shared_mutex mutex_;
+  std::vector< Entry > entries_;
+  int next_id_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
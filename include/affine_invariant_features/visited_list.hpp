@@ -0,0 +1,42 @@
+#ifndef AFFINE_INVARIANT_FEATURES_VISITED_LIST
+#define AFFINE_INVARIANT_FEATURES_VISITED_LIST
+
+#include <algorithm>
+#include <vector>
+
+namespace affine_invariant_features {
+
+//
+// Marks of visited ids which can be reset in constant time
+//
+
+class VisitedList {
+public:
+  VisitedList(const std::size_t size) : marks_(size, 0), tag_(0) {}
+
+  virtual ~VisitedList() {}
+
+  void reset() {
+    if (++tag_ == 0) {
+      std::fill(marks_.begin(), marks_.end(), 0);
+      tag_ = 1;
+    }
+  }
+
+  // mark the given id and return if it has been already marked
+  bool visit(const int id) {
+    if (marks_[id] == tag_) {
+      return true;
+    }
+    marks_[id] = tag_;
+    return false;
+  }
+
+private:
+  std::vector< unsigned int > marks_;
+  unsigned int tag_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
\ No newline at end of file
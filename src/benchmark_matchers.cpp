@@ -0,0 +1,132 @@
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <affine_invariant_features/gemm_l2_matcher.hpp>
+#include <affine_invariant_features/hnsw_matcher.hpp>
+#include <affine_invariant_features/mih_matcher.hpp>
+#include <affine_invariant_features/pq_matcher.hpp>
+#include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/sketch_matcher.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+#include <opencv2/flann.hpp>
+
+#include "aif_assert.hpp"
+
+namespace aif = affine_invariant_features;
+
+cv::Ptr< aif::Results > loadResults(const std::string &path) {
+  const cv::FileStorage file(path, cv::FileStorage::READ);
+  AIF_Assert(file.isOpened(), "Could not open %s", path.c_str());
+
+  const cv::Ptr< aif::Results > results(aif::load< aif::Results >(file.root()));
+  AIF_Assert(results, "Could not load features from %s", path.c_str());
+  return results;
+}
+
+// build an index on the reference, search 2 nearest neighbors of each query,
+// and print build time, queries per second and recall@2 against the exact neighbors
+void benchmark(const std::string &name, const cv::Ptr< cv::DescriptorMatcher > &matcher,
+               const aif::Results &query, const aif::Results &reference,
+               const std::vector< std::vector< cv::DMatch > > &truth) {
+  const double build_start(cv::getTickCount());
+  matcher->add(reference.descriptors);
+  matcher->train();
+  const double build_time((cv::getTickCount() - build_start) / cv::getTickFrequency());
+
+  const double search_start(cv::getTickCount());
+  std::vector< std::vector< cv::DMatch > > matches;
+  matcher->knnMatch(query.descriptors, matches, 2);
+  const double search_time((cv::getTickCount() - search_start) / cv::getTickFrequency());
+
+  std::size_t nfound(0), ntruth(0);
+  for (std::size_t i = 0; i < truth.size() && i < matches.size(); ++i) {
+    std::set< int > found;
+    for (std::vector< cv::DMatch >::const_iterator m = matches[i].begin(); m != matches[i].end();
+         ++m) {
+      found.insert(m->trainIdx);
+    }
+    for (std::vector< cv::DMatch >::const_iterator t = truth[i].begin(); t != truth[i].end();
+         ++t) {
+      nfound += found.count(t->trainIdx);
+      ++ntruth;
+    }
+  }
+
+  std::cout << name << ": build " << build_time << " s, "
+            << query.descriptors.rows / search_time << " queries/s, recall@2 "
+            << (ntruth > 0 ? static_cast< double >(nfound) / ntruth : 0.) << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+
+  const cv::CommandLineParser args(
+      argc, argv, "{ help | | }"
+                  "{ M | 16 | max number of links of HNSW }"
+                  "{ ef-construction | 100 | dynamic list size of HNSW on insertion }"
+                  "{ ef-search | 64 | dynamic list size of HNSW on search }"
+                  "{ sketch-bits | 256 | number of bits of sketches }"
+                  "{ reranks | 32 | number of candidates re-ranked by sketch matcher }"
+                  "{ substrings | 0 | number of substrings of MIH (0: chosen from data size) }"
+                  "{ @query-file | <none> | can be generated by extract_features }"
+                  "{ @reference-file | <none> | can be generated by extract_features }");
+
+  if (args.has("help")) {
+    args.printMessage();
+    return 0;
+  }
+
+  const int M(args.get< int >("M"));
+  const int ef_construction(args.get< int >("ef-construction"));
+  const int ef_search(args.get< int >("ef-search"));
+  const int sketch_bits(args.get< int >("sketch-bits"));
+  const int reranks(args.get< int >("reranks"));
+  const int substrings(args.get< int >("substrings"));
+  const std::string query_path(args.get< std::string >("@query-file"));
+  const std::string reference_path(args.get< std::string >("@reference-file"));
+  if (!args.check()) {
+    args.printErrors();
+    return 1;
+  }
+
+  const cv::Ptr< const aif::Results > query(loadResults(query_path));
+  const cv::Ptr< const aif::Results > reference(loadResults(reference_path));
+  AIF_Assert(query->normType == reference->normType, "Norm types of features are different");
+  std::cout << "loaded " << query->descriptors.rows << " queries and "
+            << reference->descriptors.rows << " references" << std::endl;
+
+  std::cout << "Searching exact neighbors. This may take seconds or minutes." << std::endl;
+  std::vector< std::vector< cv::DMatch > > truth;
+  {
+    cv::BFMatcher matcher(reference->normType);
+    matcher.add(reference->descriptors);
+    matcher.knnMatch(query->descriptors, truth, 2);
+  }
+
+  switch (reference->normType) {
+  case cv::NORM_L2:
+    benchmark("KDTree(4)", new cv::FlannBasedMatcher(new cv::flann::KDTreeIndexParams(4)), *query,
+              *reference, truth);
+    benchmark("HNSW", aif::HNSWMatcher::create(M, ef_construction, ef_search), *query,
+              *reference, truth);
+    benchmark("IVF-PQ", aif::PQMatcher::create(), *query, *reference, truth);
+    benchmark("IVF-PQ(no rerank)", aif::PQMatcher::create(16, 64, 8, 0), *query, *reference,
+              truth);
+    benchmark("GEMM", aif::GemmL2Matcher::create(), *query, *reference, truth);
+    benchmark("Sketch", aif::SketchMatcher::create(sketch_bits, reranks), *query, *reference,
+              truth);
+    break;
+  case cv::NORM_HAMMING:
+    benchmark("LSH(6,12,1)", new cv::FlannBasedMatcher(new cv::flann::LshIndexParams(6, 12, 1)),
+              *query, *reference, truth);
+    benchmark("MIH", aif::MIHMatcher::create(substrings), *query, *reference, truth);
+    break;
+  default:
+    AIF_Assert(false, "Unsupported norm type %d", reference->normType);
+  }
+
+  return 0;
+}
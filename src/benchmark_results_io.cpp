@@ -0,0 +1,126 @@
+#include <iostream>
+#include <string>
+
+#include <affine_invariant_features/cv_serializable.hpp>
+#include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/results_file.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <opencv2/core.hpp>
+
+#include "aif_assert.hpp"
+
+namespace aif = affine_invariant_features;
+
+bool equals(const aif::Results &a, const aif::Results &b) {
+  if (a.keypoints.size() != b.keypoints.size() || a.normType != b.normType ||
+      a.descriptors.rows != b.descriptors.rows || a.descriptors.cols != b.descriptors.cols ||
+      a.descriptors.type() != b.descriptors.type()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < a.keypoints.size(); ++i) {
+    const cv::KeyPoint &ka(a.keypoints[i]), &kb(b.keypoints[i]);
+    if (ka.pt != kb.pt || ka.size != kb.size || ka.angle != kb.angle ||
+        ka.response != kb.response || ka.octave != kb.octave || ka.class_id != kb.class_id) {
+      return false;
+    }
+  }
+  return a.descriptors.empty() || cv::norm(a.descriptors, b.descriptors, cv::NORM_INF) == 0.;
+}
+
+void print(const std::string &name, const std::string &path, const double write_time,
+           const double read_time, const bool ok) {
+  std::cout << name << ": write " << write_time << " s, read " << read_time << " s, "
+            << boost::filesystem::file_size(path) / (1024. * 1024.) << " MB"
+            << (ok ? "" : ", MISMATCH") << std::endl;
+}
+
+// write and read results in a FileStorage document, and print the times and the file size.
+// flags are added to open the document for writing (e.g. aif::getBase64StorageFlag()).
+void benchmarkFileStorage(const std::string &name, const std::string &path,
+                          const aif::Results &results, const int flags) {
+  const double write_start(cv::getTickCount());
+  {
+    cv::FileStorage file(path, cv::FileStorage::WRITE | flags);
+    AIF_Assert(file.isOpened(), "Could not open or create %s", path.c_str());
+    results.save(file);
+  }
+  const double write_time((cv::getTickCount() - write_start) / cv::getTickFrequency());
+
+  const double read_start(cv::getTickCount());
+  cv::Ptr< const aif::Results > dst;
+  {
+    const cv::FileStorage file(path, cv::FileStorage::READ);
+    AIF_Assert(file.isOpened(), "Could not open %s", path.c_str());
+    dst = aif::load< aif::Results >(file.root());
+  }
+  const double read_time((cv::getTickCount() - read_start) / cv::getTickFrequency());
+
+  print(name, path, write_time, read_time, dst && equals(results, *dst));
+}
+
+// same as above for the binary results format
+void benchmarkBinary(const std::string &name, const std::string &path,
+                     const aif::Results &results) {
+  const double write_start(cv::getTickCount());
+  aif::writeResultsFile(path, results);
+  const double write_time((cv::getTickCount() - write_start) / cv::getTickFrequency());
+
+  const double read_start(cv::getTickCount());
+  cv::Ptr< aif::Results > dst(aif::mapResultsFile(path));
+  // copy descriptors to actually read the mapped pages like the other forms
+  if (dst) {
+    dst->descriptors = dst->descriptors.clone();
+  }
+  const double read_time((cv::getTickCount() - read_start) / cv::getTickFrequency());
+
+  print(name, path, write_time, read_time, dst && equals(results, *dst));
+}
+
+int main(int argc, char *argv[]) {
+
+  const cv::CommandLineParser args(
+      argc, argv, "{ help | | }"
+                  "{ @result-file | <none> | can be generated by extract_features }"
+                  "{ @work-dir | . | directory where temporary files are written }");
+
+  if (args.has("help")) {
+    args.printMessage();
+    return 0;
+  }
+
+  const std::string result_path(args.get< std::string >("@result-file"));
+  const std::string work_dir(args.get< std::string >("@work-dir"));
+  if (!args.check()) {
+    args.printErrors();
+    return 1;
+  }
+
+  cv::Ptr< const aif::Results > results;
+  {
+    const cv::FileStorage file(result_path, cv::FileStorage::READ);
+    AIF_Assert(file.isOpened(), "Could not open %s", result_path.c_str());
+    results = aif::load< aif::Results >(file.root());
+    AIF_Assert(results, "Could not load features from %s", result_path.c_str());
+  }
+  std::cout << "loaded " << results->keypoints.size() << " feature points from " << result_path
+            << std::endl;
+
+  namespace bf = boost::filesystem;
+  const bf::path dir(work_dir);
+  const int base64_flag(aif::getBase64StorageFlag());
+  benchmarkFileStorage("YAML text", (dir / "results_text.yml").string(), *results, 0);
+  benchmarkFileStorage("XML text", (dir / "results_text.xml").string(), *results, 0);
+  if (base64_flag != 0) {
+    benchmarkFileStorage("YAML base64", (dir / "results_base64.yml").string(), *results,
+                         base64_flag);
+    benchmarkFileStorage("XML base64", (dir / "results_base64.xml").string(), *results,
+                         base64_flag);
+  } else {
+    std::cout << "Skipped base64, which requires OpenCV 3.2 or later" << std::endl;
+  }
+  benchmarkBinary("Binary", (dir / "results.aifr").string(), *results);
+
+  return 0;
+}
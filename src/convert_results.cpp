@@ -0,0 +1,63 @@
+#include <iostream>
+#include <string>
+
+#include <affine_invariant_features/cv_serializable.hpp>
+#include <affine_invariant_features/feature_parameters.hpp>
+#include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/results_file.hpp>
+#include <affine_invariant_features/target.hpp>
+
+#include <opencv2/core.hpp>
+
+#include "aif_assert.hpp"
+
+int main(int argc, char *argv[]) {
+  namespace aif = affine_invariant_features;
+
+  const cv::CommandLineParser args(
+      argc, argv, "{ help | | }"
+                  "{ @input-file | <none> | result file by extract_features, or a binary file }"
+                  "{ @output-file | <none> | binary file, or result file if the input is binary }");
+
+  if (args.has("help")) {
+    args.printMessage();
+    return 0;
+  }
+
+  const std::string input_path(args.get< std::string >("@input-file"));
+  const std::string output_path(args.get< std::string >("@output-file"));
+  if (!args.check()) {
+    args.printErrors();
+    return 1;
+  }
+
+  if (aif::isResultsFile(input_path)) {
+    // binary to FileStorage
+    const cv::Ptr< const aif::Results > results(aif::mapResultsFile(input_path));
+    AIF_Assert(results, "Could not map results in %s", input_path.c_str());
+
+    cv::FileStorage output_file(output_path, cv::FileStorage::WRITE);
+    AIF_Assert(output_file.isOpened(), "Could not open or create %s", output_path.c_str());
+
+    results->save(output_file);
+  } else {
+    // FileStorage to binary
+    const cv::FileStorage input_file(input_path, cv::FileStorage::READ);
+    AIF_Assert(input_file.isOpened(), "Could not open %s", input_path.c_str());
+
+    const cv::Ptr< const aif::Results > results(aif::load< aif::Results >(input_file.root()));
+    AIF_Assert(results, "Could not load results from %s", input_path.c_str());
+
+    // parameters and the target description are optional
+    const cv::Ptr< const aif::FeatureParameters > params(
+        aif::load< aif::FeatureParameters >(input_file.root()));
+    const cv::Ptr< const aif::TargetDescription > target_desc(
+        aif::load< aif::TargetDescription >(input_file.root()));
+
+    aif::writeResultsFile(output_path, *results, params ? params->hash() : 0,
+                          target_desc ? target_desc->hashContour() : 0);
+  }
+  std::cout << "Converted results in " << input_path << " to " << output_path << std::endl;
+
+  return 0;
+}
@@ -2,10 +2,13 @@
 #include <string>
 
 #include <affine_invariant_features/affine_invariant_feature.hpp>
+#include <affine_invariant_features/feature_cache.hpp>
 #include <affine_invariant_features/feature_parameters.hpp>
 #include <affine_invariant_features/results.hpp>
 #include <affine_invariant_features/target.hpp>
 
+#include <boost/cstdint.hpp>
+
 #include <opencv2/core.hpp>
 #include <opencv2/features2d.hpp>
 #include <opencv2/highgui.hpp>
@@ -17,6 +20,8 @@ int main(int argc, char *argv[]) {
 
   const cv::CommandLineParser args(
       argc, argv, "{ help | | }"
+                  "{ base64 | | write matrices in base64, faster to read (OpenCV 3.2 or later) }"
+                  "{ cache | | directory of cached features, which is searched before extraction }"
                   "{ @parameter-file | <none> | can be generated by generate_parameter_file }"
                   "{ @target-file | <none> | can be generated by generate_target_file }"
                   "{ @result-file | <none> | }");
@@ -26,6 +31,8 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  const bool base64(args.has("base64"));
+  const std::string cache_dir(args.get< std::string >("cache"));
   const std::string param_path(args.get< std::string >("@parameter-file"));
   const std::string target_path(args.get< std::string >("@target-file"));
   const std::string result_path(args.get< std::string >("@result-file"));
@@ -33,6 +40,8 @@ int main(int argc, char *argv[]) {
     args.printErrors();
     return 1;
   }
+  const int base64_flag(base64 ? aif::getBase64StorageFlag() : 0);
+  AIF_Assert(!base64 || base64_flag != 0, "Base64 output requires OpenCV 3.2 or later");
 
   const cv::FileStorage param_file(param_path, cv::FileStorage::READ);
   AIF_Assert(param_file.isOpened(), "Could not open %s", param_path.c_str());
@@ -47,37 +56,66 @@ int main(int argc, char *argv[]) {
   const cv::FileStorage target_file(target_path, cv::FileStorage::READ);
   AIF_Assert(target_file.isOpened(), "Could not open %s", target_path.c_str());
 
-  const cv::Ptr< const aif::TargetDescription > target_desc(
-      aif::load< aif::TargetDescription >(target_file.root()));
-  AIF_Assert(target_desc, "Could not load an target description from %s", target_path.c_str());
-
-  const cv::Ptr< const aif::TargetData > target_data(aif::TargetData::retrieve(*target_desc));
-  AIF_Assert(target_data, "Could not load target data described in %s", target_path.c_str());
-
-  cv::Mat target_image(target_data->image / 4);
-  target_data->image.copyTo(target_image, target_data->mask);
-  std::cout << "Showing the target image with mask. Press any key to continue." << std::endl;
-  cv::imshow("Target", target_image);
-  cv::waitKey(0);
-
-  std::cout << "Extracting features. This may take seconds or minutes." << std::endl;
-  aif::Results results;
-  feature->detectAndCompute(target_data->image, target_data->mask, results.keypoints,
-                            results.descriptors);
-  results.normType = feature->defaultNorm();
-
-  cv::Mat result_image;
-  cv::drawKeypoints(target_image, results.keypoints, result_image);
-  std::cout << "Showing a result image with keypoints. Press any key to continue." << std::endl;
-  cv::imshow("Results", result_image);
-  cv::waitKey(0);
+  // the target image is not decoded if cached features are found
+  const cv::Ptr< const aif::LazyTargetData > target_data(
+      aif::load< aif::LazyTargetData >(target_file.root()));
+  AIF_Assert(target_data, "Could not load an target description from %s", target_path.c_str());
+  const aif::TargetDescription &target_desc(target_data->getDescription());
+
+  // extraction runs without the cache if the cache directory is not available
+  const cv::Ptr< const aif::FeatureCache > cache(
+      cache_dir.empty() ? cv::Ptr< aif::FeatureCache >() : aif::FeatureCache::open(cache_dir));
+  if (!cache_dir.empty() && !cache) {
+    std::cout << "Could not open the cache directory " << cache_dir << ". Running without cache."
+              << std::endl;
+  }
+  // the cache key is the md5 of the actual image rather than one in the description
+  // because the image may have been changed after the description was generated
+  const std::string md5(cache ? aif::TargetDescription::generateMD5(target_data->getPath())
+                              : std::string());
+  const boost::uint64_t params_hash(params->hash());
+  // the contour is a part of the key because it masks the extraction
+  const boost::uint64_t contour_hash(target_desc.hashContour());
+
+  cv::Ptr< aif::Results > results(cache ? cache->find(md5, params_hash, contour_hash)
+                                        : cv::Ptr< aif::MappedResults >());
+  if (results) {
+    std::cout << "Loaded features from " << cache->getPath(md5, params_hash, contour_hash)
+              << ". Skipped decoding and showing the target image." << std::endl;
+  } else {
+    const cv::Ptr< const aif::TargetData > data(target_data->getData());
+    AIF_Assert(data, "Could not load target data described in %s", target_path.c_str());
+
+    cv::Mat target_image(data->image / 4);
+    data->image.copyTo(target_image, data->mask);
+    std::cout << "Showing the target image with mask. Press any key to continue." << std::endl;
+    cv::imshow("Target", target_image);
+    cv::waitKey(0);
+
+    std::cout << "Extracting features. This may take seconds or minutes." << std::endl;
+    results = new aif::Results();
+    feature->detectAndCompute(data->image, data->mask, results->keypoints, results->descriptors);
+    results->normType = feature->defaultNorm();
+    if (cache && cache->insert(md5, params_hash, contour_hash, *results)) {
+      std::cout << "Cached features to " << cache->getPath(md5, params_hash, contour_hash)
+                << std::endl;
+    } else if (cache) {
+      std::cout << "Could not cache features to " << cache->getDirectory() << std::endl;
+    }
+
+    cv::Mat result_image;
+    cv::drawKeypoints(target_image, results->keypoints, result_image);
+    std::cout << "Showing a result image with keypoints. Press any key to continue." << std::endl;
+    cv::imshow("Results", result_image);
+    cv::waitKey(0);
+  }
 
-  cv::FileStorage result_file(result_path, cv::FileStorage::WRITE);
+  cv::FileStorage result_file(result_path, cv::FileStorage::WRITE | base64_flag);
   AIF_Assert(result_file.isOpened(), "Could not open or create %s", result_path.c_str());
 
   params->save(result_file);
-  target_desc->save(result_file);
-  results.save(result_file);
+  target_desc.save(result_file);
+  results->save(result_file);
   std::cout << "Wrote context and results of feature extraction to " << result_path << std::endl;
 
   return 0;
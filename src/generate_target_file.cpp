@@ -13,6 +13,7 @@ int main(int argc, char *argv[]) {
 
   const cv::CommandLineParser args(
       argc, argv, "{ help | | }"
+                  "{ xxh64 | | also describe xxh64 of the image, which is faster than md5 }"
                   "{ @image | <none> | absolute, or relative to the current path or <package> }"
                   "{ @file | <none> | output file describing the image }"
                   "{ @package | | optional name of a ROS package where the image locates }");
@@ -22,6 +23,7 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  const bool use_xxh64(args.has("xxh64"));
   const std::string image_path(args.get< std::string >("@image"));
   const std::string file_path(args.get< std::string >("@file"));
   const std::string package_name(args.get< std::string >("@package"));
@@ -38,6 +40,9 @@ int main(int argc, char *argv[]) {
   target.package = package_name;
   target.path = image_path;
   target.md5 = aif::TargetDescription::generateMD5(resolved_path);
+  if (use_xxh64) {
+    target.xxh64 = aif::TargetDescription::generateXXH64(resolved_path);
+  }
   target.contour.push_back(cv::Point(0, 0));
   target.contour.push_back(cv::Point(image.cols - 1, 0));
   target.contour.push_back(cv::Point(image.cols - 1, image.rows - 1));
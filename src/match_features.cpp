@@ -2,10 +2,14 @@
 #include <string>
 
 #include <affine_invariant_features/feature_parameters.hpp>
+#include <affine_invariant_features/lazy_results.hpp>
 #include <affine_invariant_features/target.hpp>
 #include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/results_file.hpp>
 #include <affine_invariant_features/result_matcher.hpp>
 
+#include <boost/cstdint.hpp>
+
 #include <opencv2/core.hpp>
 #include <opencv2/features2d.hpp>
 
@@ -13,21 +17,67 @@
 
 namespace aif = affine_invariant_features;
 
-void loadAll(const std::string &path, cv::Ptr< aif::TargetData > &target_data,
-             cv::Ptr< aif::Results > &results) {
+// the target image is not decoded until it is drawn.
+// parameters are optional and the hash of them is 0 if there are not.
+cv::Ptr< aif::LazyTargetData > loadTargetData(const std::string &path,
+                                              boost::uint64_t *params_hash = NULL) {
+  const cv::FileStorage file(path, cv::FileStorage::READ);
+  AIF_Assert(file.isOpened(), "Could not open %s", path.c_str());
+
+  const cv::Ptr< aif::LazyTargetData > target_data(aif::load< aif::LazyTargetData >(file.root()));
+  AIF_Assert(target_data, "Could not load a target description from %s", path.c_str());
+
+  if (params_hash) {
+    const cv::Ptr< const aif::FeatureParameters > params(
+        aif::load< aif::FeatureParameters >(file.root()));
+    *params_hash = params ? params->hash() : 0;
+  }
+  return target_data;
+}
+
+// a binary feature file has only features and the target description is read
+// from the target file. if the target file also has parameters (e.g. a feature file),
+// the binary features must have been extracted by them.
+// otherwise the target file is optional and overrides the description.
+void loadAll(const std::string &path, const std::string &target_path,
+             cv::Ptr< aif::LazyTargetData > &target_data, cv::Ptr< aif::Results > &results) {
+  if (aif::isResultsFile(path)) {
+    AIF_Assert(!target_path.empty(), "No target file is given for the binary feature file %s",
+               path.c_str());
+    boost::uint64_t params_hash;
+    target_data = loadTargetData(target_path, &params_hash);
+
+    // keypoints are read and descriptors are mapped without copying
+    const cv::Ptr< const aif::LazyResults > lazy_results(
+        aif::LazyResults::open(path, params_hash));
+    AIF_Assert(lazy_results, "Could not open features in %s or they are not by parameters in %s",
+               path.c_str(), target_path.c_str());
+    results = lazy_results->getResults();
+    AIF_Assert(lazy_results->getDescriptors().rows == lazy_results->getDescriptorRows(),
+               "Could not map descriptors in %s", path.c_str());
+    return;
+  }
+
   const cv::FileStorage file(path, cv::FileStorage::READ);
   AIF_Assert(file.isOpened(), "Could not open %s", path.c_str());
 
-  target_data = aif::load< aif::TargetData >(file.root());
-  AIF_Assert(target_data, "Could not load target data described in %s", path.c_str());
+  if (target_path.empty()) {
+    target_data = aif::load< aif::LazyTargetData >(file.root());
+    AIF_Assert(target_data, "Could not load a target description from %s", path.c_str());
+  } else {
+    target_data = loadTargetData(target_path);
+  }
 
   results = aif::load< aif::Results >(file.root());
   AIF_Assert(results, "Could not load features from %s", path.c_str());
 }
 
-cv::Mat shade(const cv::Mat &src, const cv::Mat &mask) {
-  cv::Mat dst(src / 4);
-  src.copyTo(dst, mask);
+cv::Mat shade(const aif::LazyTargetData &target_data) {
+  const cv::Ptr< const aif::TargetData > data(target_data.getData());
+  AIF_Assert(data, "Could not load the target image %s", target_data.getPath().c_str());
+
+  cv::Mat dst(data->image / 4);
+  data->image.copyTo(dst, data->mask);
   return dst;
 }
 
@@ -35,8 +85,12 @@ int main(int argc, char *argv[]) {
 
   const cv::CommandLineParser args(
       argc, argv, "{ help | | }"
-                  "{ @feature-file1 | <none> | can be generated by extract_features }"
-                  "{ @feature-file2 | <none> | can be generated by extract_features }"
+                  "{ hough-angle-bin | 0 | rotation bin of voting in degrees (0: disabled) }"
+                  "{ sample-size | 4 | correspondences per hypothesis of verification (1, 2 or 4) }"
+                  "{ target-file1 | | target description required if feature-file1 is binary }"
+                  "{ target-file2 | | target description required if feature-file2 is binary }"
+                  "{ @feature-file1 | <none> | by extract_features, or binary by convert_results }"
+                  "{ @feature-file2 | <none> | by extract_features, or binary by convert_results }"
                   "{ @image | | optional output image }");
 
   if (args.has("help")) {
@@ -44,6 +98,11 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  aif::VerificationParameters verification_params;
+  verification_params.houghAngleBin = args.get< double >("hough-angle-bin");
+  verification_params.sampleSize = args.get< int >("sample-size");
+  const std::string target_path1(args.get< std::string >("target-file1"));
+  const std::string target_path2(args.get< std::string >("target-file2"));
   const std::string feature_path1(args.get< std::string >("@feature-file1"));
   const std::string feature_path2(args.get< std::string >("@feature-file2"));
   const std::string image_path(args.get< std::string >("@image"));
@@ -52,27 +111,28 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  cv::Ptr< aif::TargetData > target1;
+  cv::Ptr< aif::LazyTargetData > target1;
   cv::Ptr< aif::Results > results1;
-  loadAll(feature_path1, target1, results1);
+  loadAll(feature_path1, target_path1, target1, results1);
   std::cout << "loaded " << results1->keypoints.size() << " feature points from " << feature_path1
             << std::endl;
 
-  cv::Ptr< aif::TargetData > target2;
+  cv::Ptr< aif::LazyTargetData > target2;
   cv::Ptr< aif::Results > results2;
-  loadAll(feature_path2, target2, results2);
+  loadAll(feature_path2, target_path2, target2, results2);
   std::cout << "loaded " << results2->keypoints.size() << " feature points from " << feature_path2
             << std::endl;
 
   aif::ResultMatcher matcher(results2);
+  matcher.setVerificationParameters(verification_params);
   std::cout << "Matching feature points. This may take seconds." << std::endl;
   cv::Matx33f transform;
   std::vector< cv::DMatch > matches;
   matcher.match(*results1, transform, matches);
   std::cout << "found " << matches.size() << " matches" << std::endl;
 
-  const cv::Mat image1(shade(target1->image, target1->mask));
-  const cv::Mat image2(shade(target2->image, target2->mask));
+  const cv::Mat image1(shade(*target1));
+  const cv::Mat image2(shade(*target2));
   cv::Mat image;
   cv::drawMatches(image1, results1->keypoints, image2, results2->keypoints, matches, image);
 
@@ -0,0 +1,56 @@
+#include <iostream>
+#include <string>
+
+#include <affine_invariant_features/cv_serializable.hpp>
+#include <affine_invariant_features/feature_parameters.hpp>
+#include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/results_database_file.hpp>
+#include <affine_invariant_features/target.hpp>
+
+#include <opencv2/core.hpp>
+
+#include "aif_assert.hpp"
+
+int main(int argc, char *argv[]) {
+  namespace aif = affine_invariant_features;
+
+  // cv::CommandLineParser does not accept a variable number of arguments
+  const std::string first_arg(argc > 1 ? argv[1] : "");
+  const bool help(first_arg == "-h" || first_arg == "--help");
+  if (help || argc < 3) {
+    std::cout << "Usage: " << argv[0] << " <database-file> <result-file1> [<result-file2> ...]\n"
+              << "Packs result files generated by extract_features into a database file.\n"
+              << "The i-th result file is stored with id i-1." << std::endl;
+    return help ? 0 : 1;
+  }
+
+  const std::string db_path(argv[1]);
+  aif::DatabaseFileWriter writer(db_path);
+
+  for (int i = 2; i < argc; ++i) {
+    const std::string result_path(argv[i]);
+    const cv::FileStorage result_file(result_path, cv::FileStorage::READ);
+    AIF_Assert(result_file.isOpened(), "Could not open %s", result_path.c_str());
+
+    const cv::Ptr< const aif::Results > results(aif::load< aif::Results >(result_file.root()));
+    AIF_Assert(results, "Could not load results from %s", result_path.c_str());
+
+    // parameters and the target description are optional
+    const cv::Ptr< const aif::FeatureParameters > params(
+        aif::load< aif::FeatureParameters >(result_file.root()));
+    const cv::Ptr< const aif::TargetDescription > target_desc(
+        aif::load< aif::TargetDescription >(result_file.root()));
+
+    const int id(i - 2);
+    writer.add(id, *results, params ? params->hash() : 0,
+               target_desc ? target_desc->md5 : std::string(),
+               target_desc ? target_desc->hashContour() : 0);
+    std::cout << "Packed " << result_path << " as id " << id << std::endl;
+  }
+
+  const bool closed(writer.close());
+  AIF_Assert(closed, "Could not write %s", db_path.c_str());
+  std::cout << "Wrote " << argc - 2 << " results to " << db_path << std::endl;
+
+  return 0;
+}